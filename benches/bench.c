@@ -0,0 +1,94 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+// Runs one workload several times and prints a JSON line with median
+// wall time, ops per second and peak resident set size.
+// usage: bench <name> <runs> <ops> <command> [args...]
+
+typedef struct {
+    double seconds;
+    long peak_rss_kb;
+    int status;
+} Run;
+
+double now(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Program output would dominate timing on a terminal, so it is dropped
+Run run_once(char **argv){
+    double start = now();
+    pid_t pid = fork();
+    if(pid < 0){
+        perror("fork");
+        exit(1);
+    }
+    if(pid == 0){
+        int null = open("/dev/null", O_RDWR);
+        dup2(null, STDIN_FILENO);
+        dup2(null, STDOUT_FILENO);
+        execvp(argv[0], argv);
+        perror(argv[0]);
+        _exit(127);
+    }
+    int status;
+    struct rusage usage;
+    if(wait4(pid, &status, 0, &usage) < 0){
+        perror("wait4");
+        exit(1);
+    }
+    return (Run){
+        .seconds     = now() - start,
+        .peak_rss_kb = usage.ru_maxrss,
+        .status      = WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status),
+    };
+}
+
+int compare_seconds(const void *a, const void *b){
+    double lhs = ((Run*)a)->seconds;
+    double rhs = ((Run*)b)->seconds;
+    return (lhs > rhs) - (lhs < rhs);
+}
+
+int main(int argc, char **argv){
+    if(argc < 5){
+        fprintf(stderr, "usage: %s <name> <runs> <ops> <command> [args...]\n", argv[0]);
+        return 1;
+    }
+    char *name = argv[1];
+    int runc = atoi(argv[2]);
+    double ops = atof(argv[3]);
+    if(runc <= 0){
+        fprintf(stderr, "Error: runs has to be positive, got '%s'\n", argv[2]);
+        return 1;
+    }
+    Run *runs = malloc(runc * sizeof(Run));
+    long peak_rss_kb = 0;
+    for(int i = 0; i<runc; i++){
+        runs[i] = run_once(argv + 4);
+        if(runs[i].status != 0){
+            fprintf(stderr, "Error: %s exited with status %d\n", name, runs[i].status);
+            return 1;
+        }
+        if(runs[i].peak_rss_kb > peak_rss_kb){
+            peak_rss_kb = runs[i].peak_rss_kb;
+        }
+    }
+    qsort(runs, runc, sizeof(Run), compare_seconds);
+    double median = (runc % 2) ? runs[runc/2].seconds
+                               : (runs[runc/2 - 1].seconds + runs[runc/2].seconds) / 2;
+    printf("{\"bench\": \"%s\", \"runs\": %d, \"median_s\": %.6f, \"min_s\": %.6f, \"max_s\": %.6f, "
+           "\"ops\": %.0f, \"ops_per_s\": %.0f, \"peak_rss_kb\": %ld}\n",
+           name, runc, median, runs[0].seconds, runs[runc-1].seconds,
+           ops, ops / median, peak_rss_kb);
+    free(runs);
+    return 0;
+}
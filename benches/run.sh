@@ -0,0 +1,16 @@
+# Runs every benches/*.cbr workload with an optimized ciberia and prints
+# one JSON line per workload. The '# ops: N' first line of a workload is
+# the amount of work it does: loop iterations, calls or items handled.
+# BENCH_RUNS sets runs per workload, BENCH_FLAGS is passed to ciberia,
+# e.g. BENCH_FLAGS=--tree-walk make bench
+set -e
+runs=${BENCH_RUNS:-5}
+for file in ./benches/*.cbr; do
+    name=`basename $file .cbr`
+    ops=`head -n 1 $file | sed -n 's/^# ops: *//p'`
+    if [ -z "$ops" ]; then
+        echo "Error: $file has no '# ops: N' first line" >&2
+        exit 1
+    fi
+    ./benches/bench "$name${BENCH_FLAGS:+ $BENCH_FLAGS}" $runs $ops ./ciberia $BENCH_FLAGS $file
+done
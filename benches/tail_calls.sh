@@ -0,0 +1,16 @@
+# Tail calls run in constant stack and memory: recursion a million calls
+# deep has to pass with 256K of native stack and 20M of address space.
+# Fails unless every engine finishes it with the expected output.
+expected="i64 total = 500000500000
+i64 even = 0"
+failed=0
+for engine in "" "--tree-walk"; do
+    echo "# tail_calls.cbr "$engine"..."
+    output=`ulimit -s 256; ulimit -v 20000; ./ciberia $engine ./benches/tail_calls.cbr 2>&1`
+    if [ $? -ne 0 ] || [ "$output" != "$expected" ]; then
+        echo "$output"
+        echo "# FAILED tail_calls.cbr "$engine
+        failed=1
+    fi
+done
+exit $failed
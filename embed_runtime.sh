@@ -0,0 +1,13 @@
+# usage: sh embed_runtime.sh files... > src/runtime_sources.h
+# Turns runtime sources into one array of C string lines, --emit-c writes
+# them into every generated program, so the interpreter needs no sources
+# at run time. Includes of runtime.h are left out, it comes first.
+echo "// Generated by embed_runtime.sh from $*, do not edit"
+echo "char *RUNTIME_SOURCE[] = {"
+for file in "$@"; do
+    printf '    "\\n// %s\\n",\n' "`basename $file`"
+    grep -v -x '#include "runtime.h"' "$file" \
+        | sed -e 's/\\/\\\\/g' -e 's/"/\\"/g' -e 's/^/    "/' -e 's/$/\\n",/'
+done
+echo "    NULL"
+echo "};"
@@ -1,5 +1,4 @@
-#include "types.h"
-#include "functions.h"
+#include "runtime.h"
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -17,227 +16,334 @@
 #include <unistd.h>
 #endif
 
-CBReturn cbrstd_print(Token *expr, size_t call_exprc, Variables *variables, size_t depth){
+OutBuffer out = {0};
+bool unbuffered = false;
+
+void out_flush(void){
+    if(out.size == 0){
+        return;
+    }
+    fwrite(out.data, 1, out.size, stdout);
+    fflush(stdout);
+    out.size = 0;
+}
+
+// Makes room for size bytes, size is at most OUT_CAP
+char *out_reserve(size_t size){
+    if(out.size + size > OUT_CAP){
+        out_flush();
+    }
+    return out.data + out.size;
+}
+
+void out_write(char *data, size_t size){
+    while(size > 0){
+        size_t chunk = (size < OUT_CAP) ? size : OUT_CAP;
+        memcpy(out_reserve(chunk), data, chunk);
+        out.size += chunk;
+        data += chunk;
+        size -= chunk;
+    }
+}
+
+static const char DIGIT_PAIRS[] =
+    "00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+    "40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+    "8081828384858687888990919293949596979899";
+
+// Decimal digits are produced two at a time from the back
+void out_num(ssize_t num){
+    char digits[24];
+    char *end = digits + sizeof(digits);
+    char *p = end;
+    size_t n = (num < 0) ? -(size_t)num : (size_t)num;
+    while(n >= 100){
+        p -= 2;
+        memcpy(p, DIGIT_PAIRS + (n%100)*2, 2);
+        n /= 100;
+    }
+    if(n >= 10){
+        p -= 2;
+        memcpy(p, DIGIT_PAIRS + n*2, 2);
+    } else {
+        *--p = '0' + n;
+    }
+    if(num < 0){
+        *--p = '-';
+    }
+    size_t size = end - p;
+    memcpy(out_reserve(size), p, size);
+    out.size += size;
+}
+
+// Items as "{1, 2, 3}", element type is switched on once per array
+#define OUT_ITEMS(item) \
+    for(size_t j = 0; j<var.size; j++){ \
+        if(j > 0){ \
+            out_write(", ", 2); \
+        } \
+        out_num(item); \
+    }
+void out_array(Variable var){
+    out_write("{", 1);
+    switch(var.type){
+        case TYPE_I8:  OUT_ITEMS(((int8_t*)var.ptr)[j]);  break;
+        case TYPE_I32: OUT_ITEMS(((int32_t*)var.ptr)[j]); break;
+        case TYPE_I64: OUT_ITEMS(((ssize_t*)var.ptr)[j]); break;
+        default:       OUT_ITEMS(get_arr_num_value(var, j)); // reports unsupported type
+    }
+    out_write("}", 1);
+}
+
+CBReturn cbrstd_print(Variable *args, size_t argc){
     CBReturn ret = {.returned=false, .type=0, .num=0};
-    size_t i = 0;
-    Token token = expr[i];
-    while(i<call_exprc){
-        switch(token.type){
-            case TOKEN_STR_LITERAL:
-                printf("%.*s", SVVARG(token.sv));
-                break;
-            case TOKEN_NUMERIC:
-                printf("%ld", SVTOL(token.sv));
-                break;
-            case TOKEN_NAME:
-                {
-                    Variable var = get_var_by_name(token.sv, variables, depth);
-                    if(var.name.data!=NULL){ // if token is variable, get numeric of value and exit
-                        if(var.modifyer==MOD_ARRAY && var.type==TYPE_STRING){
-                            printf("%.*s", (int)var.size, (char*)var.ptr);
-                            break;
-                        }
-                        if(var.modifyer==MOD_ARRAY){
-                            if(expr[i+1].type!=TOKEN_OSQUAR){
-                                printf("{");
-                                for(size_t j=0; j<var.size-1; j++){
-                                    printf("%zd, ", get_arr_num_value(var, j));
-                                }
-                                printf("%zd", get_arr_num_value(var, var.size-1));
-                                printf("}");
-                                break;
-                            }
-                            i++;
-                            Token *expr_start = &expr[++i];
-                            size_t exprc;
-                            COLLECT_EXPR(TOKEN_OSQUAR, TOKEN_CSQUAR, expr, i);
-                            i++;
-                            ssize_t index = evaluate_expr(expr_start, exprc, variables, depth).num;
-                            printf("%zd", get_arr_num_value(var, index));
-                            break;
-                        }
-                        printf("%zd", get_num_value(var, token.loc));
-                        break;
-                    }
-                    // if token is not var name, then it should be function
-                    // so we will grep fucntion call and call it a day
-                    Token *expr_start = &expr[i];
-                    size_t exprc=0;
-                    COLLECT_EXPR(TOKEN_OPAREN, TOKEN_CPAREN, expr, i);
-                    ssize_t tmp = evaluate_expr(expr_start, exprc, variables, depth).num;
-                    printf("%zd", tmp);
-                }
-                break;
-            default:
-                TOKENERROR(" Error: You dumbass forgot semicolon, got ");
+    for(size_t i = 0; i<argc; i++){
+        Variable var = args[i];
+        if(var.modifyer==MOD_ARRAY && var.type==TYPE_STRING){
+            out_write(var.ptr, strnlen(var.ptr, var.size)); // size counts terminator
+            continue;
+        }
+        if(var.modifyer==MOD_ARRAY){
+            out_array(var);
+            continue;
         }
-        token = expr[++i];
+        out_num(get_num_value(var, global_location));
+    }
+    if(unbuffered){
+        out_flush();
     }
     return ret;
 }
 
-CBReturn cbrstd_dprint(Token *expr, size_t call_exprc, Variables *variables, size_t depth){
+CBReturn cbrstd_dprint(Variable *args, size_t argc){
     CBReturn ret = {.returned=false, .type=0, .num=0};
-    size_t i=0;
-    Token token = expr[i];
-    Variable var;
-    while(i<call_exprc){
-        switch(token.type){
-            case TOKEN_NAME:
-                var = get_var_by_name(token.sv, variables, depth);
-                if(var.modifyer==MOD_ARRAY){
-                    //debug_variable(var);
-                    printf("%s %.*s[%zu] = {", TYPE_TO_STR[var.type], SVVARG(var.name), var.size);
-                    for(size_t j=0; j<var.size-1; j++){
-                        printf("%zd, ", get_arr_num_value(var, j));
-                    }
-                    printf("%zd", get_arr_num_value(var, var.size-1));
-                    puts("}");
-                } else {
-                    printf("%s %.*s = %zd\n", TYPE_TO_STR[var.type],
-                            SVVARG(var.name), get_num_value(var, token.loc));
-                }
-                break;
-            default:
-                TOKENERROR(" Error: 'dprint' supports only variables, got ");
+    for(size_t i = 0; i<argc; i++){
+        Variable var = args[i];
+        if(var.name.data == NULL){
+            GLOBALERROR(" Error: 'dprint' supports only variables");
+        }
+        char *type = TYPE_TO_STR[var.type];
+        out_write(type, strlen(type));
+        out_write(" ", 1);
+        out_write(var.name.data, var.name.size);
+        if(var.modifyer==MOD_ARRAY){
+            out_write("[", 1);
+            out_num(var.size);
+            out_write("] = ", 4);
+            out_array(var);
+        } else {
+            out_write(" = ", 3);
+            out_num(get_num_value(var, global_location));
         }
-        token = expr[++i];
+        out_write("\n", 1);
+    }
+    if(unbuffered){
+        out_flush();
     }
     return ret;
 }
 
-CBReturn cbrstd_readTo(Token *expr, size_t call_exprc, Variables *variables, size_t depth){
+CBReturn cbrstd_readTo(Variable *args, size_t argc){
     CBReturn ret = {.returned=false, .type=0, .num=0};
-    size_t i=0;
-    Token token = expr[i];
     int mlced=256;
-    char *str_input=malloc(mlced);
+    char *str_input=calloc(mlced, 1);
     char *str_input_copy=str_input;
+    out_flush(); // prompt has to be seen before waiting for input
     fgets(str_input, mlced, stdin);
-    while(i<call_exprc){
-        switch(token.type){
-            case TOKEN_NAME:{
-                ssize_t scanned = strtol(str_input, &str_input, 10);
-                Variable var = get_var_by_name(token.sv, variables, depth);
-                if(var.modifyer==MOD_ARRAY){
-                    TOKENERROR(" Error: readTo does notr support arrays, got ")
-                }
-                CBReturn tmpret = {.type=TYPE_I64, .num=scanned};
-                var_cast(&var, tmpret);
-                break;
-            }
-            default:
-                TOKENERROR(" Error: 'readTo' supports only variables, got ");
+    for(size_t i = 0; i<argc; i++){
+        Variable *var = &args[i];
+        if(var->name.data == NULL){
+            GLOBALERROR(" Error: 'readTo' supports only variables");
+        }
+        if(var->modifyer==MOD_ARRAY){
+            GLOBALERROR(" Error: readTo does notr support arrays");
         }
-        token = expr[++i];
+        ssize_t scanned = strtol(str_input, &str_input, 10);
+        CBReturn tmpret = {.type=TYPE_NUMERIC, .num=scanned};
+        var_cast(var, tmpret);
     }
     free(str_input_copy);
     return ret;
 }
 
-CBReturn cbrstd_readlnTo(Token *expr, size_t call_exprc, Variables *variables, size_t depth){
+// same as readTo, but also accepts array items
+CBReturn cbrstd_readlnTo(Variable *args, size_t argc){
     CBReturn ret = {.returned=false, .type=0, .num=0};
-    size_t i=0;
-    Token token = expr[i];
     int mlced=256;
-    char *str_input=malloc(mlced);
+    char *str_input=calloc(mlced, 1);
     char *str_input_copy=str_input;
+    out_flush(); // prompt has to be seen before waiting for input
     fgets(str_input, mlced, stdin);
-    while(i<call_exprc){
-        switch(token.type){
-            case TOKEN_NAME:{
-                Variable var = get_var_by_name(token.sv, variables, depth);
-                ssize_t scanned = strtol(str_input, &str_input, 10);
-                if(var.modifyer==MOD_ARRAY){
-                    token = expr[i++];
-                    Token *expr_start = &expr[i];
-                    size_t expr_size=0;
-                    while(token.type != TOKEN_CSQUAR){
-                        token = expr[++i];
-                        expr_size++;
-                    }
-                    size_t arr_index = evaluate_expr(expr_start, expr_size, variables, depth).num;
-                    void *arr_id_ptr=NULL;
-                    switch(var.type){
-                        case TYPE_I8:
-                            arr_id_ptr = (int8_t*)var.ptr+arr_index;
-                            break;
-                        case TYPE_I32:
-                            arr_id_ptr = (int32_t*)var.ptr+arr_index;
-                            break;
-                        case TYPE_I64:
-                            arr_id_ptr = (ssize_t*)var.ptr+arr_index;
-                            break;
-                        default:
-                            break;
-                    }
-                    var = (Variable){.name = var.name, .modifyer = MOD_NO_MOD, .type = var.type, .ptr = arr_id_ptr};
-                }
-                CBReturn tmpret = {.type=var.type, .num=scanned};
-                var_cast(&var, tmpret);
-                break;
-            }
-            default:
-                TOKENERROR(" Error: 'readTo' supports only variables, got ");
+    for(size_t i = 0; i<argc; i++){
+        Variable *var = &args[i];
+        if(var->name.data == NULL || var->modifyer==MOD_ARRAY){
+            GLOBALERROR(" Error: 'readlnTo' supports only variables and array items");
         }
-        token = expr[++i];
+        ssize_t scanned = strtol(str_input, &str_input, 10);
+        CBReturn tmpret = {.type=var->type, .num=scanned};
+        var_cast(var, tmpret);
     }
     free(str_input_copy);
     return ret;
 }
 
-CBReturn cbrstd_sleep(Token *expr, size_t call_exprc, Variables *variables, size_t depth){
-    (void) expr;
-    (void) call_exprc;
-    (void) variables;
-    (void) depth;
+CBReturn cbrstd_sleep(Variable *args, size_t argc){
     CBReturn ret = {.returned=false, .type=0, .num=0};
-    Token token = expr[0];
-    if(expr[0].type!=TOKEN_NUMERIC){
-        RUNTIMEERROR(" Error: only numerics are supported for std 'sleep' function now")
+    if(argc!=1 || args[0].modifyer==MOD_ARRAY){
+        GLOBALERROR(" Error: only numerics are supported for std 'sleep' function now")
     }
-    sleep(SVTOL(expr[0].sv));
+    out_flush();
+    sleep(get_num_value(args[0], global_location));
     return ret;
 }
 
-CBReturn cbrstd_random(Token *expr, size_t call_exprc, Variables *variables, size_t depth){
-    (void) expr;
-    (void) call_exprc;
-    (void) variables;
-    (void) depth;
+CBReturn cbrstd_random(Variable *args, size_t argc){
+    (void) args;
+    (void) argc;
     CBReturn ret = {.returned=true, .type=TYPE_I32, .num=0};
     ret.num = random()&0xffffffff;
     return ret;
 }
-#define STD_CAP 1024
-CBReturn (*cbrstd_functions[STD_CAP]) (Token*, size_t, Variables*, size_t);
+// Number array argument of array functions, strings and scalars are errors
+Variable std_number_array(Variable *args, size_t argc, size_t i, size_t expected, char *name){
+    if(argc != expected){
+        printloc(global_location);
+        logf(" Error: '%s' expects %zu arguments, got %zu\n", name, expected, argc);
+        exit(1);
+    }
+    Variable arr = args[i];
+    if(arr.modifyer != MOD_ARRAY || (arr.type != TYPE_I8 && arr.type != TYPE_I32 && arr.type != TYPE_I64)){
+        printloc(global_location);
+        logf(" Error: '%s' expects i8, i32 or i64 array as argument %zu\n", name, i+1);
+        exit(1);
+    }
+    return arr;
+}
 
-unsigned long char_hash(char *str){
-    unsigned long hash = 5381;
-    int c;
-    while ((c = *str++))
-        hash = ((hash << 5) + hash) + c; /* hash * 33 + c */
+void std_overflow(bool overflow, char *name){
+    if(overflow){
+        printloc(global_location);
+        logf(" Error: '%s' overflows i64\n", name);
+        exit(1);
+    }
+}
 
-    return hash;
+CBReturn cbrstd_sum(Variable *args, size_t argc){
+    bool overflow = false;
+    ssize_t sum = array_sum(std_number_array(args, argc, 0, 1, "sum"), &overflow);
+    std_overflow(overflow, "sum");
+    return (CBReturn){.returned=true, .type=TYPE_NUMERIC, .num=sum};
 }
 
-void setup_cbrstd(void){
-    srandom(time(NULL));
-    cbrstd_functions[char_hash("print") % STD_CAP] = &cbrstd_print;
-    cbrstd_functions[char_hash("dprint") % STD_CAP] = &cbrstd_dprint;
-    cbrstd_functions[char_hash("readlnTo") % STD_CAP] = &cbrstd_readlnTo;
-    cbrstd_functions[char_hash("readTo") % STD_CAP] = &cbrstd_readTo;
-    cbrstd_functions[char_hash("sleep") % STD_CAP] = &cbrstd_sleep;
-    cbrstd_functions[char_hash("random") % STD_CAP] = &cbrstd_random;
-}
-
-CBReturn stdcall(Token *expr, size_t call_exprc, Variables *variables, size_t depth){
-    size_t i = 0;
-    Token token = expr[i];
-    if(cbrstd_functions[hash(token.sv)%STD_CAP]==NULL){
-        /* printloc(global_location); */
-        logf("Error: unknown stdcall %.*s\n", SVVARG(token.sv));
+CBReturn cbrstd_min(Variable *args, size_t argc){
+    Variable arr = std_number_array(args, argc, 0, 1, "min");
+    if(arr.size == 0){
+        GLOBALERROR(" Error: 'min' of empty array");
+    }
+    return (CBReturn){.returned=true, .type=TYPE_NUMERIC, .num=array_min(arr)};
+}
+
+CBReturn cbrstd_max(Variable *args, size_t argc){
+    Variable arr = std_number_array(args, argc, 0, 1, "max");
+    if(arr.size == 0){
+        GLOBALERROR(" Error: 'max' of empty array");
+    }
+    return (CBReturn){.returned=true, .type=TYPE_NUMERIC, .num=array_max(arr)};
+}
+
+CBReturn cbrstd_count(Variable *args, size_t argc){
+    Variable arr = std_number_array(args, argc, 0, 2, "count");
+    ssize_t value = get_num_value(args[1], global_location);
+    size_t count = 0;
+    if(value >= TYPE_MIN[arr.type] && value <= TYPE_MAX[arr.type]){ // others are never stored
+        count = array_count(arr, value);
+    }
+    return (CBReturn){.returned=true, .type=TYPE_NUMERIC, .num=count};
+}
+
+CBReturn cbrstd_fill(Variable *args, size_t argc){
+    Variable arr = std_number_array(args, argc, 0, 2, "fill");
+    ssize_t value = get_num_value(args[1], global_location);
+    if(value < TYPE_MIN[arr.type] || value > TYPE_MAX[arr.type]){
+        printloc(global_location);
+        logf(" ");
+        range_error(arr.type, arr.name, value);
+    }
+    array_fill(arr, value);
+    return (CBReturn){.returned=false, .type=0, .num=0};
+}
+
+CBReturn cbrstd_dot(Variable *args, size_t argc){
+    Variable a = std_number_array(args, argc, 0, 2, "dot");
+    Variable b = std_number_array(args, argc, 1, 2, "dot");
+    if(a.type != b.type || a.size != b.size){
+        printloc(global_location);
+        logf(" Error: 'dot' expects arrays of same type and length, got %s[%zu] and %s[%zu]\n",
+                TYPE_TO_STR[a.type], a.size, TYPE_TO_STR[b.type], b.size);
+        exit(1);
+    }
+    bool overflow = false;
+    ssize_t dot = array_dot(a, b, &overflow);
+    std_overflow(overflow, "dot");
+    return (CBReturn){.returned=true, .type=TYPE_NUMERIC, .num=dot};
+}
+
+// std.copy dst dstOff src srcOff n, ranges may overlap
+CBReturn cbrstd_copy(Variable *args, size_t argc){
+    Variable dst = std_number_array(args, argc, 0, 5, "copy");
+    Variable src = std_number_array(args, argc, 2, 5, "copy");
+    ssize_t dst_off = get_num_value(args[1], global_location);
+    ssize_t src_off = get_num_value(args[3], global_location);
+    ssize_t n       = get_num_value(args[4], global_location);
+    if(dst.type != src.type){
+        printloc(global_location);
+        logf(" Error: 'copy' expects arrays of same type, got %s[] and %s[]\n",
+                TYPE_TO_STR[dst.type], TYPE_TO_STR[src.type]);
+        exit(1);
+    }
+    if(n < 0 || dst_off < 0 || src_off < 0 || dst_off > (ssize_t)dst.size - n || src_off > (ssize_t)src.size - n){
+        printloc(global_location);
+        logf(" Error: 'copy' of %zd items from %zd of %zd to %zd of %zd is out of range\n",
+                n, src_off, (ssize_t)src.size, dst_off, (ssize_t)dst.size);
         exit(69);
     }
-    return cbrstd_functions[hash(token.sv)%STD_CAP](expr+1, call_exprc-1, variables, depth);
+    ssize_t item_size = get_type_size_in_bytes(dst.type);
+    memmove((char*)dst.ptr + dst_off*item_size, (char*)src.ptr + src_off*item_size, n*item_size);
+    return (CBReturn){.returned=false, .type=0, .num=0};
+}
+
+StdEntry cbrstd_functions[] = {
+    {"print",    &cbrstd_print},
+    {"dprint",   &cbrstd_dprint},
+    {"readlnTo", &cbrstd_readlnTo},
+    {"readTo",   &cbrstd_readTo},
+    {"sleep",    &cbrstd_sleep},
+    {"random",   &cbrstd_random},
+    {"sum",      &cbrstd_sum},
+    {"min",      &cbrstd_min},
+    {"max",      &cbrstd_max},
+    {"count",    &cbrstd_count},
+    {"fill",     &cbrstd_fill},
+    {"dot",      &cbrstd_dot},
+    {"copy",     &cbrstd_copy},
+};
+
+// Looked up once per call site by resolver, NULL if there is no such function
+StdFunction find_stdcall(SView name){
+    for(size_t i = 0; i<sizeof(cbrstd_functions)/sizeof(cbrstd_functions[0]); i++){
+        if(SVCMP(name, cbrstd_functions[i].name)==0){
+            return cbrstd_functions[i].fn;
+        }
+    }
+    return NULL;
+}
+
+// Only readers store into their scalar arguments
+bool stdcall_writes_args(StdFunction fn){
+    return fn == &cbrstd_readTo || fn == &cbrstd_readlnTo;
+}
+
+void setup_cbrstd(void){
+    srandom(time(NULL));
+    atexit(out_flush);
 }
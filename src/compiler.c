@@ -0,0 +1,610 @@
+#include "types.h"
+#include "functions.h"
+
+// Compiles function trees into register bytecode for the VM.
+// Every local lives in the register of its resolver slot, temporaries
+// live above locals and are released after each statement.
+
+size_t emit(Compiler *this, enum OpcodeEnum op, enum TypeEnum type, ssize_t a, ssize_t b, ssize_t c, Token token){
+    Bytecode *bc = this->bc;
+    bc->code   = realloc(bc->code, sizeof(Instr)*(bc->codec+1));
+    bc->tokens = realloc(bc->tokens, sizeof(Token)*(bc->codec+1));
+    bc->code[bc->codec]   = (Instr){.op = op, .type = type, .a = a, .b = b, .c = c};
+    bc->tokens[bc->codec] = token;
+    stats.instructions += (op != OP_PROFILE);
+    return bc->codec++;
+}
+
+// Range checked instructions name the assigned variable in their error
+size_t emit_checked(Compiler *this, enum OpcodeEnum op, enum TypeEnum type, ssize_t a, ssize_t b, ssize_t c, Token token){
+    if(TYPE_MIN[type] != INT64_MIN){
+        token.sv = this->target.sv;
+    }
+    return emit(this, op, type, a, b, c, token);
+}
+
+// compile_cond_jump result when constant condition never jumps
+#define NO_JUMP SIZE_MAX
+
+// Events for --profile, --stats and --sample-profile, the sampler only
+// follows calls. Nothing is emitted without these flags.
+void emit_profile(Compiler *this, enum ProfileEvent event, size_t arg, Token token){
+    if(event <= PROFILE_LINE ? trace_statements : tracing){
+        emit(this, OP_PROFILE, TYPE_I64, event, arg, token.loc.row, token);
+    }
+}
+
+void patch_jump(Compiler *this, size_t at, size_t target){
+    if(at == NO_JUMP){
+        return;
+    }
+    Instr *instr = &this->bc->code[at];
+    if(instr->op == OP_JMP || instr->op == OP_JZ || instr->op == OP_JNZ){
+        instr->b = target;
+    } else {
+        instr->c = target;
+    }
+}
+
+uint16_t alloc_reg(Compiler *this){
+    if(this->next_reg >= UINT16_MAX){
+        printloc(this->target.loc);
+        logf(" Error: function '%.*s' needs too many registers\n", SVVARG(this->fn->name));
+        exit(1);
+    }
+    uint16_t reg = this->next_reg++;
+    if(this->next_reg > this->bc->regc){
+        this->bc->regc = this->next_reg;
+    }
+    return reg;
+}
+
+// Variables were bound to slots by resolver, slot is the register of the variable
+Local expr_local(Expr *expr){
+    Var_signature *sig = expr->decl;
+    return (Local){.name = sig->name, .type = sig->type, .modifyer = sig->modifyer, .reg = expr->slot};
+}
+
+Local expr_array_or_fail(Expr *expr){
+    Token token = expr->token;
+    Local local = expr_local(expr);
+    if(local.modifyer != MOD_ARRAY || local.type == TYPE_STRING){
+        TOKENERROR(" Error: trying to use usual variable as array ");
+    }
+    return local;
+}
+
+// Locals are only tracked to free owned arrays when their scope ends
+void push_local(Compiler *this, Local local){
+    local.depth = this->depth;
+    this->locals = realloc(this->locals, sizeof(Local)*(this->localc+1));
+    this->locals[this->localc++] = local;
+}
+
+size_t add_const(Compiler *this, ssize_t num){
+    Bytecode *bc = this->bc;
+    bc->consts = realloc(bc->consts, sizeof(ssize_t)*(bc->constc+1));
+    bc->consts[bc->constc] = num;
+    return bc->constc++;
+}
+
+size_t add_string(Compiler *this, SView sv){
+    Bytecode *bc = this->bc;
+    bc->strings = realloc(bc->strings, sizeof(Variable)*(bc->stringc+1));
+    bc->strings[bc->stringc] = (Variable){.type = TYPE_STRING, .modifyer = MOD_ARRAY,
+                                          .ptr = sv.data, .size = sv.size};
+    return bc->stringc++;
+}
+
+// Frees arrays owned by scopes deeper or equal to depth, scopes stay registered
+void emit_scope_frees(Compiler *this, size_t depth, Token token){
+    for(size_t i = this->localc; i>0 && this->locals[i-1].depth >= depth; i--){
+        if(this->locals[i-1].owned){
+            emit(this, OP_FREEARR, TYPE_I64, this->locals[i-1].reg, 0, 0, token);
+        }
+    }
+}
+
+void enter_scope(Compiler *this){
+    this->depth++;
+}
+
+void leave_scope(Compiler *this, Token token){
+    emit_scope_frees(this, this->depth, token);
+    while(this->localc > 0 && this->locals[this->localc-1].depth == this->depth){
+        this->localc--;
+    }
+    this->depth--;
+}
+
+enum OpcodeEnum BINOP_TO_OP[] = {
+    [BINOP_ADD       ] = OP_ADD,
+    [BINOP_SUB       ] = OP_SUB,
+    [BINOP_MUL       ] = OP_MUL,
+    [BINOP_DIV       ] = OP_DIV,
+    [BINOP_MOD       ] = OP_MOD,
+    [BINOP_LESS      ] = OP_LESS,
+    [BINOP_LESS_EQ   ] = OP_LESS_EQ,
+    [BINOP_GREATER   ] = OP_GREATER,
+    [BINOP_GREATER_EQ] = OP_GREATER_EQ,
+    [BINOP_EQ        ] = OP_EQ,
+    [BINOP_NOT_EQ    ] = OP_NOT_EQ,
+};
+
+// jump taken when comparison holds, and when it does not
+enum OpcodeEnum BINOP_TO_JUMP[] = {
+    [BINOP_LESS      ] = OP_JLESS,
+    [BINOP_LESS_EQ   ] = OP_JLESS_EQ,
+    [BINOP_GREATER   ] = OP_JGREATER,
+    [BINOP_GREATER_EQ] = OP_JGREATER_EQ,
+    [BINOP_EQ        ] = OP_JEQ,
+    [BINOP_NOT_EQ    ] = OP_JNOT_EQ,
+};
+enum OpcodeEnum BINOP_TO_NOT_JUMP[] = {
+    [BINOP_LESS      ] = OP_JGREATER_EQ,
+    [BINOP_LESS_EQ   ] = OP_JGREATER,
+    [BINOP_GREATER   ] = OP_JLESS_EQ,
+    [BINOP_GREATER_EQ] = OP_JLESS,
+    [BINOP_EQ        ] = OP_JNOT_EQ,
+    [BINOP_NOT_EQ    ] = OP_JEQ,
+};
+
+// Second row skips the bounds check, used for indices proven in range
+enum OpcodeEnum TYPE_TO_LOADIDX[2][TYPE_I64 + 1] = {
+    {[TYPE_I8 ] = OP_LOADIDX_I8,  [TYPE_I32] = OP_LOADIDX_I32,  [TYPE_I64] = OP_LOADIDX_I64},
+    {[TYPE_I8 ] = OP_LOADIDXU_I8, [TYPE_I32] = OP_LOADIDXU_I32, [TYPE_I64] = OP_LOADIDXU_I64},
+};
+enum OpcodeEnum TYPE_TO_STOREIDX[2][TYPE_I64 + 1] = {
+    {[TYPE_I8 ] = OP_STOREIDX_I8,  [TYPE_I32] = OP_STOREIDX_I32,  [TYPE_I64] = OP_STOREIDX_I64},
+    {[TYPE_I8 ] = OP_STOREIDXU_I8, [TYPE_I32] = OP_STOREIDXU_I32, [TYPE_I64] = OP_STOREIDXU_I64},
+};
+
+void check_assign_type(Token token, enum TypeEnum type, enum TypeEnum src_type){
+    if(src_type != type && src_type != TYPE_NUMERIC){
+        type_mismatch_error(token.loc, type, token.sv, src_type);
+    }
+}
+
+enum TypeEnum compile_expr(Compiler *this, Expr *expr, uint16_t dst, enum TypeEnum check);
+
+// Returns register holding expr value, scalar variables are used in place
+uint16_t compile_expr_reg(Compiler *this, Expr *expr, enum TypeEnum *type){
+    enum TypeEnum tmp_type;
+    if(type == NULL){
+        type = &tmp_type;
+    }
+    if(expr->kind == EXPR_VAR){
+        Local local = expr_local(expr);
+        if(local.modifyer != MOD_ARRAY){
+            *type = local.type;
+            return local.reg;
+        }
+    }
+    uint16_t reg = alloc_reg(this);
+    *type = compile_expr(this, expr, reg, TYPE_I64);
+    return reg;
+}
+
+uint16_t compile_call_args(Compiler *this, Expr *call, Func *fn){
+    Token token = call->token;
+    uint16_t base = this->next_reg;
+    for(size_t j = 0; j<fn->argc; j++){
+        alloc_reg(this);
+    }
+    Token target = this->target;
+    for(size_t j = 0; j<fn->argc; j++){
+        Var_signature sig = fn->args[j];
+        Expr *arg = call->call.args[j];
+        token = arg->token;
+        if(sig.modifyer == MOD_ARRAY){
+            Local src = {0};
+            if(arg->kind == EXPR_VAR){
+                src = expr_local(arg);
+            }
+            if(src.modifyer != MOD_ARRAY){
+                printloc(token.loc);
+                logf(" Error: expected array as argument '%s %.*s[]'\n",
+                        TYPE_TO_STR[sig.type], SVVARG(sig.name));
+                exit(1);
+            }
+            if(src.type != sig.type){
+                printloc(token.loc);
+                logf(" Error: expected '%s' array, got '%s'\n", TYPE_TO_STR[sig.type], TYPE_TO_STR[src.type]);
+                exit(1);
+            }
+            emit(this, OP_MOV, TYPE_I64, base+j, src.reg, 0, token);
+            continue;
+        }
+        this->target = (Token){.loc = token.loc, .sv = sig.name};
+        enum TypeEnum type = compile_expr(this, arg, base+j, sig.type);
+        check_assign_type(this->target, sig.type, type);
+    }
+    this->target = target;
+    return base;
+}
+
+enum TypeEnum compile_call(Compiler *this, Expr *call, uint16_t dst, enum TypeEnum check){
+    Token token = call->token;
+    Func *fn = call->call.fn;
+    size_t fn_id = fn - functions.funcs;
+    size_t reg_mark = this->next_reg;
+    if(TYPE_MIN[check] != INT64_MIN){ // return value is range checked on move
+        uint16_t ret = alloc_reg(this);
+        uint16_t base = compile_call_args(this, call, fn);
+        emit_profile(this, PROFILE_CALL, fn_id, token);
+        emit(this, OP_CALL, TYPE_I64, ret, fn_id, base, token);
+        emit_checked(this, OP_MOV, check, dst, ret, 0, token);
+    } else {
+        uint16_t base = compile_call_args(this, call, fn);
+        emit_profile(this, PROFILE_CALL, fn_id, token);
+        emit(this, OP_CALL, TYPE_I64, dst, fn_id, base, token);
+    }
+    this->next_reg = reg_mark;
+    return TYPE_NUMERIC;
+}
+
+enum TypeEnum compile_stdcall(Compiler *this, Expr *call, uint16_t dst, enum TypeEnum check){
+    Token token = call->token;
+    size_t reg_mark = this->next_reg;
+    StdCallSite site = {.fn = call->call.std, .argc = call->call.argc};
+    site.args = calloc(site.argc ? site.argc : 1, sizeof(StdArg));
+    for(size_t i = 0; i<site.argc; i++){
+        Expr *arg = call->call.args[i];
+        StdArg *std_arg = &site.args[i];
+        std_arg->name = arg->token.sv;
+        Local local;
+        switch(arg->kind){
+            case EXPR_STRING:
+                std_arg->kind = STDARG_STRING;
+                std_arg->reg  = add_string(this, arg->token.sv);
+                break;
+            case EXPR_VAR:
+                local = expr_local(arg);
+                std_arg->kind = (local.modifyer == MOD_ARRAY) ? STDARG_REF : STDARG_LVALUE;
+                std_arg->type = local.type;
+                std_arg->reg  = local.reg;
+                break;
+            case EXPR_INDEX:
+                local = expr_array_or_fail(arg);
+                std_arg->kind = STDARG_ITEM;
+                std_arg->type = local.type;
+                std_arg->reg  = local.reg;
+                std_arg->index_reg = compile_expr_reg(this, arg->index, NULL);
+                std_arg->loc  = arg->token.loc;
+                break;
+            default:
+                std_arg->kind = STDARG_VALUE;
+                std_arg->type = TYPE_I64;
+                std_arg->reg  = compile_expr_reg(this, arg, NULL);
+                break;
+        }
+    }
+    Bytecode *bc = this->bc;
+    bc->stdcalls = realloc(bc->stdcalls, sizeof(StdCallSite)*(bc->stdcallc+1));
+    bc->stdcalls[bc->stdcallc] = site;
+    emit_checked(this, OP_STDCALL, check, dst, bc->stdcallc++, 0, token);
+    this->next_reg = reg_mark;
+    return TYPE_NUMERIC;
+}
+
+// Compiles expr into dst, result is range checked against check type,
+// returns expression type: the rightmost typed operand, as in evaluate_expr
+enum TypeEnum compile_expr(Compiler *this, Expr *expr, uint16_t dst, enum TypeEnum check){
+    Token token = expr->token;
+    Local local;
+    size_t reg_mark = this->next_reg;
+    switch(expr->kind){
+        case EXPR_NUMERIC:
+            if(expr->num >= INT32_MIN && expr->num <= INT32_MAX){
+                emit_checked(this, OP_LOADI, check, dst, expr->num, 0, token);
+            } else {
+                emit_checked(this, OP_LOADK, check, dst, add_const(this, expr->num), 0, token);
+            }
+            return TYPE_NUMERIC;
+        case EXPR_STRING:
+            emit(this, OP_LOADSTR, TYPE_I64, dst, add_string(this, token.sv), 0, token);
+            return TYPE_STRING;
+        case EXPR_VAR:
+            local = expr_local(expr);
+            if(local.modifyer == MOD_ARRAY && local.type != TYPE_STRING){
+                RUNTIMEERROR(" Error: expected .length or [index] after array name");
+            }
+            if(dst != local.reg){
+                emit_checked(this, OP_MOV, (local.type == check) ? TYPE_I64 : check, dst, local.reg, 0, token);
+            }
+            return local.type;
+        case EXPR_INDEX:{
+            local = expr_array_or_fail(expr);
+            uint16_t index = compile_expr_reg(this, expr->index, NULL);
+            emit(this, TYPE_TO_LOADIDX[expr->in_range][local.type], TYPE_I64, dst, local.reg, index, token);
+            this->next_reg = reg_mark;
+            return local.type;
+        }
+        case EXPR_LENGTH:
+            local = expr_local(expr);
+            if(local.modifyer != MOD_ARRAY){
+                TOKENERROR(" Error: only arrays have length, got ");
+            }
+            emit_checked(this, OP_LEN, check, dst, local.reg, 0, token);
+            return TYPE_NUMERIC;
+        case EXPR_BINARY:{
+            enum TypeEnum lhs_type, rhs_type;
+            enum BinopEnum op = expr->binary.op;
+            uint16_t lhs = compile_expr_reg(this, expr->binary.lhs, &lhs_type);
+            Expr *rhs_expr = expr->binary.rhs;
+            if((op == BINOP_ADD || op == BINOP_SUB) && rhs_expr->kind == EXPR_NUMERIC
+                    && rhs_expr->num > INT32_MIN && rhs_expr->num <= INT32_MAX){
+                rhs_type = TYPE_NUMERIC;
+                emit_checked(this, OP_ADDI, check, dst, lhs, (op == BINOP_ADD) ? rhs_expr->num : -rhs_expr->num, token);
+            } else {
+                uint16_t rhs = compile_expr_reg(this, rhs_expr, &rhs_type);
+                enum TypeEnum type = (op >= BINOP_LESS) ? TYPE_I64 : check;
+                emit_checked(this, BINOP_TO_OP[op], type, dst, lhs, rhs, token);
+            }
+            this->next_reg = reg_mark;
+            if(lhs_type == TYPE_STRING || rhs_type == TYPE_STRING){
+                RUNTIMEERROR(" Error: arithmetic on strings is not supported");
+            }
+            if(op >= BINOP_LESS){
+                return TYPE_NUMERIC;
+            }
+            return (rhs_type != TYPE_NUMERIC) ? rhs_type : lhs_type;
+        }
+        case EXPR_CALL:
+            return compile_call(this, expr, dst, check);
+        case EXPR_STDCALL:
+            return compile_stdcall(this, expr, dst, check);
+    }
+    return TYPE_NUMERIC;
+}
+
+// Emits jump to be patched, taken when cond equals when
+size_t compile_cond_jump(Compiler *this, Expr *cond, bool when){
+    size_t reg_mark = this->next_reg;
+    size_t at;
+    if(cond->kind == EXPR_NUMERIC){ // folded by optimizer
+        if((cond->num != 0) != when){
+            return NO_JUMP;
+        }
+        return emit(this, OP_JMP, TYPE_I64, 0, 0, 0, cond->token);
+    }
+    if(cond->kind == EXPR_BINARY && cond->binary.op >= BINOP_LESS){
+        uint16_t lhs = compile_expr_reg(this, cond->binary.lhs, NULL);
+        uint16_t rhs = compile_expr_reg(this, cond->binary.rhs, NULL);
+        enum OpcodeEnum op = when ? BINOP_TO_JUMP[cond->binary.op] : BINOP_TO_NOT_JUMP[cond->binary.op];
+        at = emit(this, op, TYPE_I64, lhs, rhs, 0, cond->token);
+    } else {
+        uint16_t reg = compile_expr_reg(this, cond, NULL);
+        at = emit(this, when ? OP_JNZ : OP_JZ, TYPE_I64, reg, 0, 0, cond->token);
+    }
+    this->next_reg = reg_mark;
+    return at;
+}
+
+void compile_statement(Compiler *this, Stmt *stmt);
+
+void compile_block(Compiler *this, Block block, Token token){
+    enter_scope(this);
+    for(size_t i = 0; i<block.stmtc; i++){
+        compile_statement(this, &block.stmts[i]);
+    }
+    leave_scope(this, token);
+}
+
+void compile_declaration(Compiler *this, Stmt *stmt){
+    Token token = stmt->token;
+    Var_signature sig = stmt->decl.sig;
+    this->target = token;
+    Local local = {.name = sig.name, .type = sig.type, .modifyer = sig.modifyer};
+    local.reg = stmt->decl.slot;
+    if(stmt->decl.size != NULL){ // variable is array
+        uint16_t size = compile_expr_reg(this, stmt->decl.size, NULL);
+        emit(this, OP_NEWARR, sig.type, local.reg, size, 0, token);
+        local.owned = true;
+    } else if(stmt->decl.value != NULL){
+        enum TypeEnum type = compile_expr(this, stmt->decl.value, local.reg, sig.type);
+        check_assign_type(token, sig.type, type);
+    } else if(sig.type == TYPE_STRING){
+        emit(this, OP_LOADSTR, TYPE_I64, local.reg, add_string(this, (SView){"", 0}), 0, token);
+    } else {
+        emit(this, OP_LOADI, TYPE_I64, local.reg, 0, 0, token);
+    }
+    push_local(this, local);
+}
+
+void compile_assignment(Compiler *this, Stmt *stmt){
+    Expr *target = stmt->assign.target;
+    Token token  = target->token;
+    enum BinopEnum op = stmt->assign.op;
+    size_t reg_mark = this->next_reg;
+    this->target = token;
+    Local local = expr_local(target);
+    if(target->kind == EXPR_INDEX){
+        local = expr_array_or_fail(target);
+        enum TypeEnum type;
+        uint16_t value = compile_expr_reg(this, stmt->assign.value, &type);
+        uint16_t index = compile_expr_reg(this, target->index, NULL);
+        bool in_range = target->in_range;
+        if(op != BINOP_NONE){
+            uint16_t item = alloc_reg(this);
+            emit(this, TYPE_TO_LOADIDX[in_range][local.type], TYPE_I64, item, local.reg, index, token);
+            emit(this, BINOP_TO_OP[op], TYPE_I64, item, item, value, token);
+            value = item;
+            type  = TYPE_NUMERIC;
+            in_range = true; // checked by the load
+        }
+        check_assign_type(token, local.type, type);
+        emit(this, TYPE_TO_STOREIDX[in_range][local.type], local.type, local.reg, index, value, token);
+    } else {
+        if(local.modifyer == MOD_ARRAY && local.type != TYPE_STRING){ // resolver checked types
+            emit(this, OP_ASSIGNARR, TYPE_I64, local.reg, expr_local(stmt->assign.value).reg, 0, token);
+        } else if(op == BINOP_NONE){
+            enum TypeEnum type = compile_expr(this, stmt->assign.value, local.reg, local.type);
+            check_assign_type(token, local.type, type);
+        } else {
+            Expr *value_expr = stmt->assign.value;
+            if(local.type == TYPE_STRING){
+                TOKENERROR(" Error: arithmetic on strings is not supported, got ");
+            }
+            if((op == BINOP_ADD || op == BINOP_SUB) && value_expr->kind == EXPR_NUMERIC
+                    && value_expr->num > INT32_MIN && value_expr->num <= INT32_MAX){
+                emit_checked(this, OP_ADDI, local.type, local.reg, local.reg,
+                        (op == BINOP_ADD) ? value_expr->num : -value_expr->num, token);
+            } else {
+                uint16_t value = compile_expr_reg(this, value_expr, NULL);
+                emit_checked(this, BINOP_TO_OP[op], local.type, local.reg, local.reg, value, token);
+            }
+        }
+    }
+    this->next_reg = reg_mark;
+}
+
+void push_label(size_t **labels, size_t *labelc, size_t at){
+    *labels = realloc(*labels, sizeof(size_t)*(*labelc+1));
+    (*labels)[(*labelc)++] = at;
+}
+
+// Loops are rotated: body first, condition at the bottom jumps back
+void compile_loop(Compiler *this, Expr *cond, Stmt *update, Block body, Token token){
+    LoopLabels *outer = this->loop;
+    LoopLabels loop = {.depth = this->depth+1};
+    this->loop = &loop;
+    // always true loop enters body directly and jumps back unconditionally
+    bool always = cond->kind == EXPR_NUMERIC && cond->num != 0;
+    size_t to_cond = always ? NO_JUMP : emit(this, OP_JMP, TYPE_I64, 0, 0, 0, token);
+    size_t body_start = this->bc->codec;
+    if(jit_enabled){
+        emit(this, OP_LOOP, TYPE_I64, 0, JIT_HOT_LOOPS, 0, token);
+    }
+    compile_block(this, body, token);
+    size_t continue_target = this->bc->codec;
+    emit_profile(this, PROFILE_LINE, token.loc.row, token);
+    if(update != NULL){
+        compile_assignment(this, update);
+    }
+    patch_jump(this, to_cond, this->bc->codec);
+    size_t back = compile_cond_jump(this, cond, true);
+    patch_jump(this, back, body_start);
+    for(size_t i = 0; i<loop.continuec; i++){
+        patch_jump(this, loop.continues[i], continue_target);
+    }
+    for(size_t i = 0; i<loop.breakc; i++){
+        patch_jump(this, loop.breaks[i], this->bc->codec);
+    }
+    free(loop.continues);
+    free(loop.breaks);
+    this->loop = outer;
+}
+
+void compile_statement(Compiler *this, Stmt *stmt){
+    Token token = stmt->token;
+    size_t reg_mark = this->next_reg;
+    emit_profile(this, PROFILE_STATEMENT, token.loc.row, token);
+    switch(stmt->kind){
+        case STMT_DECL:
+            compile_declaration(this, stmt);
+            break;
+        case STMT_ASSIGN:
+            compile_assignment(this, stmt);
+            break;
+        case STMT_EXPR:
+            this->target = token;
+            compile_expr(this, stmt->expr, alloc_reg(this), TYPE_I64);
+            this->next_reg = reg_mark;
+            break;
+        case STMT_IF:{
+            size_t to_else = compile_cond_jump(this, stmt->if_stmt.cond, false);
+            compile_block(this, stmt->if_stmt.then_block, token);
+            if(stmt->if_stmt.else_block.stmtc > 0){
+                size_t to_end = emit(this, OP_JMP, TYPE_I64, 0, 0, 0, token);
+                patch_jump(this, to_else, this->bc->codec);
+                compile_block(this, stmt->if_stmt.else_block, token);
+                patch_jump(this, to_end, this->bc->codec);
+            } else {
+                patch_jump(this, to_else, this->bc->codec);
+            }
+            break;
+        }
+        case STMT_WHILE:
+            compile_loop(this, stmt->while_stmt.cond, NULL, stmt->while_stmt.body, token);
+            break;
+        case STMT_FOR:
+            // iterator lives one level deeper, loop body two levels deeper
+            enter_scope(this);
+            compile_declaration(this, stmt->for_stmt.init);
+            compile_loop(this, stmt->for_stmt.cond, stmt->for_stmt.update, stmt->for_stmt.body, token);
+            leave_scope(this, token);
+            break;
+        case STMT_RETURN:
+            if(stmt->expr != NULL && stmt->expr->kind == EXPR_CALL && stmt->expr->call.tail){
+                Func *fn = stmt->expr->call.fn;
+                uint16_t base = compile_call_args(this, stmt->expr, fn);
+                emit_scope_frees(this, 0, token);
+                emit_profile(this, PROFILE_TAIL_CALL, fn - functions.funcs, token);
+                emit(this, OP_TAILCALL, TYPE_I64, 0, fn - functions.funcs, base, stmt->expr->token);
+            } else if(stmt->expr != NULL){
+                this->target = token;
+                enum TypeEnum type;
+                uint16_t reg = compile_expr_reg(this, stmt->expr, &type);
+                emit_scope_frees(this, 0, token);
+                emit_profile(this, PROFILE_RETURN, 0, token);
+                emit(this, OP_RET, TYPE_I64, reg, 0, 0, token);
+            } else {
+                emit_scope_frees(this, 0, token);
+                emit_profile(this, PROFILE_RETURN, 0, token);
+                emit(this, OP_RETV, TYPE_I64, 0, 0, 0, token);
+            }
+            this->next_reg = reg_mark;
+            break;
+        case STMT_BREAK:
+            emit_scope_frees(this, this->loop->depth, token);
+            push_label(&this->loop->breaks, &this->loop->breakc,
+                    emit(this, OP_JMP, TYPE_I64, 0, 0, 0, token));
+            break;
+        case STMT_CONTINUE:
+            emit_scope_frees(this, this->loop->depth, token);
+            push_label(&this->loop->continues, &this->loop->continuec,
+                    emit(this, OP_JMP, TYPE_I64, 0, 0, 0, token));
+            break;
+    }
+}
+
+void compile_function(Func *fn){
+    Compiler compiler = {.fn = fn, .bc = &fn->bytecode, .depth = 1};
+    Compiler *this = &compiler;
+    fn->jit.countdown = jit_enabled ? JIT_HOT_CALLS : 0; // 0 wraps, never compiled
+    Token token = fn->body.code[fn->body.exprc-1];
+    this->target = token;
+    // slots of arguments and locals come first
+    while(this->next_reg < fn->slotc){
+        alloc_reg(this);
+    }
+    for(size_t i = 0; i<fn->argc; i++){
+        Var_signature sig = fn->args[i];
+        Local local = {.name = sig.name, .type = sig.type, .modifyer = sig.modifyer};
+        local.reg = i;
+        this->target = (Token){.loc = token.loc, .sv = sig.name};
+        if(sig.modifyer == MOD_ARRAY && sig.copy){ // arrays are borrowed unless copy is asked
+            emit(this, OP_COPYARR, TYPE_I64, local.reg, 0, 0, token);
+            local.owned = true;
+        }
+        push_local(this, local);
+    }
+    for(size_t i = 0; i<fn->block.stmtc; i++){
+        compile_statement(this, &fn->block.stmts[i]);
+    }
+    emit_scope_frees(this, 0, token);
+    emit_profile(this, PROFILE_RETURN, 0, token);
+    emit(this, OP_RETV, TYPE_I64, 0, 0, 0, token);
+    free(compiler.locals);
+}
+
+void debug_bytecode(Func *fn){
+    logf("fn %.*s: %zu registers\n", SVVARG(fn->name), fn->bytecode.regc);
+    for(size_t i = 0; i<fn->bytecode.codec; i++){
+        Instr instr = fn->bytecode.code[i];
+        logf("%4zu %-14s %-6s %5d %5d %5d\n", i, OP_TO_STR[instr.op],
+                TYPE_TO_STR[instr.type] ? TYPE_TO_STR[instr.type] : "",
+                instr.a, instr.b, instr.c);
+    }
+}
@@ -0,0 +1,456 @@
+#include "types.h"
+#include "functions.h"
+#include "runtime_sources.h"
+
+// --emit-c: translates bytecode of every function to C on stdout. Registers
+// become locals of the C function and jumps become gotos, every check VM
+// makes is written out with its location. Generated file carries a copy of
+// runtime.h, runtime.c, simd.c and cbrstdlib.c, embedded by the build, so
+// std functions, arrays and error messages are the interpreter's own, and
+// nothing else is built in:
+//     ciberia --emit-c prog.cbr > prog.c && cc -O2 prog.c -o prog
+
+bool emit_c = false;
+bool emit_c_trampoline = false; // program has tail calls to other functions
+
+char *TYPE_TO_C[] = {
+    [TYPE_NOT_A_TYPE] = "TYPE_NOT_A_TYPE", [TYPE_NUMERIC] = "TYPE_NUMERIC",
+    [TYPE_STRING    ] = "TYPE_STRING",     [TYPE_VOID   ] = "TYPE_VOID",
+    [TYPE_I8        ] = "TYPE_I8",         [TYPE_I32    ] = "TYPE_I32",
+    [TYPE_I64       ] = "TYPE_I64",        [TYPE_U8     ] = "TYPE_U8",
+    [TYPE_U32       ] = "TYPE_U32",        [TYPE_U64    ] = "TYPE_U64",
+};
+
+char *CTYPE_OF_OP[] = {
+    [OP_LOADIDX_I8  ] = "int8_t", [OP_LOADIDX_I32  ] = "int32_t", [OP_LOADIDX_I64  ] = "ssize_t",
+    [OP_STOREIDX_I8 ] = "int8_t", [OP_STOREIDX_I32 ] = "int32_t", [OP_STOREIDX_I64 ] = "ssize_t",
+    [OP_LOADIDXU_I8 ] = "int8_t", [OP_LOADIDXU_I32 ] = "int32_t", [OP_LOADIDXU_I64 ] = "ssize_t",
+    [OP_STOREIDXU_I8] = "int8_t", [OP_STOREIDXU_I32] = "int32_t", [OP_STOREIDXU_I64] = "ssize_t",
+};
+
+char *C_COMPARE[] = {
+    [OP_LESS   ] = "<",  [OP_LESS_EQ   ] = "<=", [OP_GREATER ] = ">",
+    [OP_GREATER_EQ] = ">=", [OP_EQ     ] = "==", [OP_NOT_EQ  ] = "!=",
+    [OP_JLESS  ] = "<",  [OP_JLESS_EQ  ] = "<=", [OP_JGREATER] = ">",
+    [OP_JGREATER_EQ] = ">=", [OP_JEQ   ] = "==", [OP_JNOT_EQ ] = "!=",
+};
+
+void emit_c_string(char *data, size_t size){
+    putchar('"');
+    for(size_t i = 0; i<size; i++){
+        unsigned char c = data[i];
+        if(c == '"' || c == '\\'){
+            printf("\\%c", c);
+        } else if(isprint(c)){
+            putchar(c);
+        } else {
+            printf("\\%03o", c);
+        }
+    }
+    putchar('"');
+}
+
+void emit_c_sview(SView sv){
+    printf("(SView){");
+    emit_c_string(sv.data, sv.size);
+    printf(", %zu}", sv.size);
+}
+
+void emit_c_loc(Location loc){
+    printf("CBR_LOC(%zu, %zu)", loc.row, loc.col);
+}
+
+// VM_CHECK of instruction at, only i8 and i32 are narrower than registers
+void emit_c_check(Func *fn, size_t at, char *value){
+    Instr instr = fn->bytecode.code[at];
+    if(TYPE_MIN[instr.type] == INT64_MIN && TYPE_MAX[instr.type] == INT64_MAX){
+        return;
+    }
+    printf("    if(%s < %zd || %s > %zd){ range_error(%s, ",
+           value, TYPE_MIN[instr.type], value, TYPE_MAX[instr.type], TYPE_TO_C[instr.type]);
+    emit_c_sview(fn->bytecode.tokens[at].sv);
+    printf(", %s); }\n", value);
+}
+
+void emit_c_runtime_error(Func *fn, size_t at, char *cond, char *error){
+    printf("    if(%s){ printloc(", cond);
+    emit_c_loc(fn->bytecode.tokens[at].loc);
+    printf("); printf(\"%s\\n\"); exit(1); }\n", error);
+}
+
+void emit_c_index(Func *fn, size_t at, size_t arr, size_t index){
+    printf("    if((size_t)r%zu.num >= r%zu.ref->size){ check_index(*r%zu.ref, r%zu.num, ",
+           index, arr, arr, index);
+    emit_c_loc(fn->bytecode.tokens[at].loc);
+    printf("); }\n");
+}
+
+void emit_c_function_name(Func *fn){
+    printf("cbr_%.*s", SVVARG(fn->name));
+}
+
+void emit_c_signature(Func *fn){
+    printf("ssize_t ");
+    emit_c_function_name(fn);
+    printf("(");
+    for(size_t i = 0; i<fn->argc; i++){
+        printf("%sValue r%zu", i ? ", " : "", i);
+    }
+    printf("%s)", fn->argc ? "" : "void");
+}
+
+void emit_c_call_args(Func *callee, size_t first){
+    printf("(");
+    for(size_t i = 0; i<callee->argc; i++){
+        printf("%sr%zu", i ? ", " : "", first+i);
+    }
+    printf(")");
+}
+
+// Calls return through cbr_tail_run when there are tail calls to run
+void emit_c_call(Func *callee, size_t first){
+    if(emit_c_trampoline){
+        printf("cbr_tail_run(");
+    }
+    emit_c_function_name(callee);
+    emit_c_call_args(callee, first);
+    if(emit_c_trampoline){
+        printf(")");
+    }
+}
+
+char *std_function_name(StdFunction fn){
+    for(size_t i = 0; i<sizeof(cbrstd_functions)/sizeof(cbrstd_functions[0]); i++){
+        if(cbrstd_functions[i].fn == fn){
+            return cbrstd_functions[i].name;
+        }
+    }
+    return NULL;
+}
+
+// Same Variables vm_stdcall builds, then LVALUE arguments are written back
+void emit_c_stdcall(Func *fn, size_t at){
+    Instr instr = fn->bytecode.code[at];
+    StdCallSite *site = &fn->bytecode.stdcalls[instr.b];
+    printf("    global_location = ");
+    emit_c_loc(fn->bytecode.tokens[at].loc);
+    printf(";\n    {\n        Variable args[%zu];\n", site->argc ? site->argc : 1);
+    for(size_t i = 0; i<site->argc; i++){
+        StdArg arg = site->args[i];
+        printf("        ");
+        switch(arg.kind){
+            case STDARG_VALUE:
+                printf("args[%zu] = (Variable){.type = TYPE_I64, .modifyer = MOD_NO_MOD, .num = r%u.num};\n",
+                       i, arg.reg);
+                break;
+            case STDARG_LVALUE:
+                printf("args[%zu] = (Variable){.name = ", i);
+                emit_c_sview(arg.name);
+                printf(", .type = %s, .modifyer = MOD_NO_MOD, .num = r%u.num};\n", TYPE_TO_C[arg.type], arg.reg);
+                break;
+            case STDARG_REF:
+                printf("args[%zu] = *r%u.ref;\n        args[%zu].name = ", i, arg.reg, i);
+                emit_c_sview(arg.name);
+                printf(";\n");
+                break;
+            case STDARG_ITEM:
+                printf("check_index(*r%u.ref, r%u.num, ", arg.reg, arg.index_reg);
+                emit_c_loc(arg.loc);
+                printf(");\n");
+                printf("        args[%zu] = get_var_from_arr(*r%u.ref, r%u.num);\n", i, arg.reg, arg.index_reg);
+                break;
+            case STDARG_STRING:
+                printf("args[%zu] = cbr_str_%zu_%u;\n", i, (size_t)(fn - functions.funcs), arg.reg);
+                break;
+        }
+    }
+    printf("        r%u.num = cbrstd_%s(args, %zu).num;\n", instr.a, std_function_name(site->fn), site->argc);
+    for(size_t i = 0; i<site->argc; i++){
+        if(site->args[i].kind == STDARG_LVALUE){
+            printf("        r%u.num = args[%zu].num;\n", site->args[i].reg, i);
+        }
+    }
+    printf("    }\n");
+    char value[32];
+    snprintf(value, sizeof(value), "r%u.num", instr.a);
+    emit_c_check(fn, at, value);
+}
+
+void emit_c_instr(Func *fn, size_t at){
+    Bytecode *bc = &fn->bytecode;
+    Instr instr = bc->code[at];
+    char value[64];
+    switch(instr.op){
+        case OP_LOADI:
+        case OP_LOADK:
+            snprintf(value, sizeof(value), "(ssize_t)%zdLL",
+                     instr.op == OP_LOADI ? (ssize_t)instr.b : bc->consts[instr.b]);
+            if(instr.op == OP_LOADK && bc->consts[instr.b] == INT64_MIN){
+                snprintf(value, sizeof(value), "INT64_MIN");
+            }
+            emit_c_check(fn, at, value);
+            printf("    r%u.num = %s;\n", instr.a, value);
+            break;
+        case OP_LOADSTR:
+            printf("    r%u.ref = &cbr_str_%zu_%d;\n", instr.a, (size_t)(fn - functions.funcs), instr.b);
+            break;
+        case OP_MOV:
+            snprintf(value, sizeof(value), "r%d.num", instr.b);
+            emit_c_check(fn, at, value);
+            printf("    r%u = r%d;\n", instr.a, instr.b);
+            break;
+        case OP_ADD:
+        case OP_ADDI:
+        case OP_SUB:
+        case OP_MUL:{
+            // wraps like the interpreter does on i64
+            char op = instr.op == OP_SUB ? '-' : instr.op == OP_MUL ? '*' : '+';
+            if(instr.op == OP_ADDI){
+                printf("    value = (ssize_t)((size_t)r%d.num + (size_t)%dLL);\n", instr.b, instr.c);
+            } else {
+                printf("    value = (ssize_t)((size_t)r%d.num %c (size_t)r%d.num);\n", instr.b, op, instr.c);
+            }
+            emit_c_check(fn, at, "value");
+            printf("    r%u.num = value;\n", instr.a);
+        }break;
+        case OP_DIV:
+        case OP_MOD:
+            snprintf(value, sizeof(value), "r%d.num == 0", instr.c);
+            emit_c_runtime_error(fn, at, value, " Error: division by zero");
+            printf("    value = r%d.num %c r%d.num;\n", instr.b, instr.op == OP_DIV ? '/' : '%', instr.c);
+            emit_c_check(fn, at, "value");
+            printf("    r%u.num = value;\n", instr.a);
+            break;
+        case OP_LESS:
+        case OP_LESS_EQ:
+        case OP_GREATER:
+        case OP_GREATER_EQ:
+        case OP_EQ:
+        case OP_NOT_EQ:
+            printf("    r%u.num = r%d.num %s r%d.num;\n", instr.a, instr.b, C_COMPARE[instr.op], instr.c);
+            break;
+        case OP_JMP:
+            printf("    goto L%d;\n", instr.b);
+            break;
+        case OP_JZ:
+        case OP_JNZ:
+            printf("    if(%sr%u.num) goto L%d;\n", instr.op == OP_JZ ? "!" : "", instr.a, instr.b);
+            break;
+        case OP_JLESS:
+        case OP_JLESS_EQ:
+        case OP_JGREATER:
+        case OP_JGREATER_EQ:
+        case OP_JEQ:
+        case OP_JNOT_EQ:
+            printf("    if(r%u.num %s r%d.num) goto L%d;\n", instr.a, C_COMPARE[instr.op], instr.b, instr.c);
+            break;
+        case OP_NEWARR:
+            snprintf(value, sizeof(value), "r%d.num < 0", instr.b);
+            emit_c_runtime_error(fn, at, value, " Error: negative array size");
+            printf("    r%u.ref = new_array(%s, r%d.num, ", instr.a, TYPE_TO_C[instr.type], instr.b);
+            emit_c_sview(bc->tokens[at].sv);
+            printf(");\n");
+            break;
+        case OP_COPYARR:
+            printf("    {\n");
+            printf("        Variable *arr = new_array(r%u.ref->type, r%u.ref->size, r%u.ref->name);\n",
+                   instr.a, instr.a, instr.a);
+            printf("        memcpy(arr->ptr, r%u.ref->ptr, get_type_size_in_bytes(arr->type)*arr->size);\n", instr.a);
+            printf("        r%u.ref = arr;\n    }\n", instr.a);
+            break;
+        case OP_ASSIGNARR:
+            printf("    assign_array(*r%u.ref, *r%d.ref, ", instr.a, instr.b);
+            emit_c_loc(bc->tokens[at].loc);
+            printf(");\n");
+            break;
+        case OP_FREEARR:
+            printf("    free(r%u.ref);\n", instr.a);
+            break;
+        case OP_LEN:
+            snprintf(value, sizeof(value), "(ssize_t)r%d.ref->size", instr.b);
+            emit_c_check(fn, at, value);
+            printf("    r%u.num = r%d.ref->size;\n", instr.a, instr.b);
+            break;
+        case OP_LOADIDX_I8:
+        case OP_LOADIDX_I32:
+        case OP_LOADIDX_I64:
+            emit_c_index(fn, at, instr.b, instr.c);
+            // fallthrough
+        case OP_LOADIDXU_I8:
+        case OP_LOADIDXU_I32:
+        case OP_LOADIDXU_I64:
+            printf("    r%u.num = ((%s*)r%d.ref->ptr)[r%d.num];\n", instr.a, CTYPE_OF_OP[instr.op], instr.b, instr.c);
+            break;
+        case OP_STOREIDX_I8:
+        case OP_STOREIDX_I32:
+        case OP_STOREIDX_I64:
+            emit_c_index(fn, at, instr.a, instr.b);
+            // fallthrough
+        case OP_STOREIDXU_I8:
+        case OP_STOREIDXU_I32:
+        case OP_STOREIDXU_I64:
+            snprintf(value, sizeof(value), "r%d.num", instr.c);
+            emit_c_check(fn, at, value);
+            printf("    ((%s*)r%u.ref->ptr)[r%d.num] = r%d.num;\n", CTYPE_OF_OP[instr.op], instr.a, instr.b, instr.c);
+            break;
+        case OP_CALL:
+            printf("    r%u.num = ", instr.a);
+            emit_c_call(&functions.funcs[instr.b], instr.c);
+            printf(";\n");
+            break;
+        case OP_TAILCALL:{
+            Func *callee = &functions.funcs[instr.b];
+            if(callee != fn){
+                // caller runs it once this frame is gone, see emit_c_tail_run
+                for(size_t i = 0; i<callee->argc; i++){
+                    printf("    cbr_tail_args[%zu] = r%zu;\n", i, instr.c+i);
+                }
+                printf("    cbr_tail_fn = %zu;\n    return 0;\n", (size_t)(callee - functions.funcs) + 1);
+                break;
+            }
+            // self tail call moves arguments down like VM and starts over
+            for(size_t i = 0; i<callee->argc; i++){
+                printf("    r%zu = r%zu;\n", i, instr.c+i);
+            }
+            printf("    goto L0;\n");
+        }break;
+        case OP_STDCALL:
+            emit_c_stdcall(fn, at);
+            break;
+        case OP_RET:
+            printf("    return r%u.num;\n", instr.a);
+            break;
+        case OP_RETV:
+            printf("    return 0;\n");
+            break;
+        case OP_PROFILE: // no events in generated code
+        case OP_LOOP:
+        case OP_COUNT:
+            break;
+    }
+}
+
+void emit_c_function(Func *fn){
+    Bytecode *bc = &fn->bytecode;
+    size_t id = fn - functions.funcs;
+    bool *targets = calloc(bc->codec + 1, sizeof(bool));
+    for(size_t i = 0; i<bc->codec; i++){
+        Instr instr = bc->code[i];
+        if(instr.op == OP_JMP || instr.op == OP_JZ || instr.op == OP_JNZ){
+            targets[instr.b] = true;
+        } else if(instr.op >= OP_JLESS && instr.op <= OP_JNOT_EQ){
+            targets[instr.c] = true;
+        } else if(instr.op == OP_TAILCALL && &functions.funcs[instr.b] == fn){
+            targets[0] = true;
+        }
+    }
+    for(size_t i = 0; i<bc->stringc; i++){
+        printf("static char cbr_str_data_%zu_%zu[] = ", id, i);
+        emit_c_string(bc->strings[i].ptr, bc->strings[i].size);
+        printf(";\nstatic Variable cbr_str_%zu_%zu = {.type = TYPE_STRING, .modifyer = MOD_ARRAY, "
+               ".ptr = cbr_str_data_%zu_%zu, .size = %zu};\n", id, i, id, i, bc->strings[i].size);
+    }
+    emit_c_signature(fn);
+    printf("{\n    ssize_t value;\n    (void)value;\n");
+    // not every register is read, arguments and temporaries may go unused
+    for(size_t i = 0; i<bc->regc; i++){
+        if(i >= fn->argc){
+            printf("    Value r%zu = {0};\n", i);
+        }
+        printf("    (void)r%zu;\n", i);
+    }
+    for(size_t i = 0; i<bc->codec; i++){
+        if(targets[i]){
+            printf("L%zu:;\n", i);
+        }
+        emit_c_instr(fn, i);
+    }
+    if(targets[bc->codec]){
+        printf("L%zu:;\n", bc->codec);
+    }
+    if(bc->codec == 0 || targets[bc->codec]
+       || (bc->code[bc->codec-1].op != OP_RET && bc->code[bc->codec-1].op != OP_RETV)){
+        printf("    return 0;\n");
+    }
+    printf("}\n\n");
+    free(targets);
+}
+
+// Generated program is standalone, it carries its own copy of the runtime
+// sources, embedded in the interpreter at build time
+void emit_c_runtime(void){
+    for(char **line = RUNTIME_SOURCE; *line != NULL; line++){
+        fputs(*line, stdout);
+    }
+}
+
+// Tail calls to other functions leave callee and arguments here and return,
+// the caller runs them in a loop. Mutual recursion then takes constant C
+// stack whether or not the C compiler turns it into jumps.
+void emit_c_tail_run(void){
+    size_t argc = 1;
+    bool *targets = calloc(functions.funcc, sizeof(bool));
+    for(size_t i = 0; i<functions.funcc; i++){
+        Bytecode *bc = &functions.funcs[i].bytecode;
+        for(size_t j = 0; j<bc->codec; j++){
+            if(bc->code[j].op != OP_TAILCALL){
+                continue;
+            }
+            Func *callee = &functions.funcs[bc->code[j].b];
+            if(callee != &functions.funcs[i]){
+                targets[callee - functions.funcs] = true;
+                argc = (callee->argc > argc) ? callee->argc : argc;
+                emit_c_trampoline = true;
+            }
+        }
+    }
+    if(emit_c_trampoline){
+        printf("static size_t cbr_tail_fn = 0; // function index + 1, 0 is none\n");
+        printf("static Value cbr_tail_args[%zu];\n\n", argc);
+        printf("ssize_t cbr_tail_run(ssize_t value){\n");
+        printf("    while(cbr_tail_fn){\n");
+        printf("        size_t fn = cbr_tail_fn - 1;\n");
+        printf("        cbr_tail_fn = 0;\n");
+        printf("        switch(fn){\n");
+        for(size_t i = 0; i<functions.funcc; i++){
+            if(!targets[i]){
+                continue;
+            }
+            printf("            case %zu: value = ", i);
+            emit_c_function_name(&functions.funcs[i]);
+            printf("(");
+            for(size_t j = 0; j<functions.funcs[i].argc; j++){
+                printf("%scbr_tail_args[%zu]", j ? ", " : "", j);
+            }
+            printf("); break;\n");
+        }
+        printf("        }\n    }\n    return value;\n}\n\n");
+    }
+    free(targets);
+}
+
+void emit_c_program(char *file_path, Func *entry){
+    printf("// Generated by ciberia --emit-c from %s\n", file_path);
+    emit_c_runtime();
+    printf("\nstatic char cbr_file[] = ");
+    emit_c_string(file_path, strlen(file_path));
+    printf(";\n#define CBR_LOC(row, col) ((Location){cbr_file, row, col})\n\n");
+    for(size_t i = 0; i<functions.funcc; i++){
+        emit_c_signature(&functions.funcs[i]);
+        printf(";\n");
+    }
+    printf("\n");
+    emit_c_tail_run();
+    for(size_t i = 0; i<functions.funcc; i++){
+        emit_c_function(&functions.funcs[i]);
+    }
+    printf("int main(void){\n");
+    printf("    verbose = %s;\n", verbose ? "true" : "false");
+    printf("    unbuffered = %s;\n", unbuffered ? "true" : "false");
+    printf("    setup_cbrstd();\n");
+    printf("    setup_simd(%s);\n", simd_max == SIMD_SCALAR ? "SIMD_SCALAR"
+                                  : simd_max == SIMD_SSE2   ? "SIMD_SSE2" : "SIMD_AVX2");
+    printf("    ");
+    emit_c_call(entry, 0);
+    printf(";\n    return 0;\n}\n");
+}
@@ -1,106 +1,251 @@
 // function call handling
-            {
-            Token fn_token = expr[i];
-            Token token = expr[i];
-                bool is_stdcall=false;
-                if(SVCMP(expr[i].sv, "std")==0){
-                    if(expr[i+1].type!=TOKEN_DOT){
-                        token = expr[i+1];
-                        TOKENERROR("expected '.' after 'std' in stdcall");
-                    }
-                    i+=2;
-                    is_stdcall = true;
-                }
-                if(is_stdcall){
-                    Token *expr_start = &expr[i];
-                    size_t exprc = 0;
-                    for(int i=0, depth_level = 0; token.type!=TOKEN_CPAREN || depth_level>0; i++){
-                        token = expr[i];
-                        global_location = token.loc;
-                        exprc++;
-                        switch(token.type){
-                            case TOKEN_OPAREN:depth_level++;break;
-                            case TOKEN_CPAREN:depth_level--;break;
-                            default:break;
-                        }
-                    }
-                    CBReturn cbret = stdcall(expr_start, exprc, variables, depth);
-                    postfix[j].type = RPN_NUM;
-                    postfix[j].numeric = cbret.num;
-                    j++;
-                    break;
-                }
-            // not an std call
-            token = expr[++i];
-            if(token.type!=TOKEN_OPAREN){
-                TOKENERROR(" Error: you probably skipped '()' when function call. Otherwise you are f@cked up. Got ")
+Func *find_function(SView name){
+    if(functions.index_cap == 0){
+        return NULL;
+    }
+    size_t mask = functions.index_cap-1;
+    for(size_t i = hash(name)&mask; functions.index[i]; i = (i+1)&mask){
+        Func *fn = &functions.funcs[functions.index[i]-1];
+        if(SVSVCMP(name, fn->name) == 0){
+            return fn;
+        }
+    }
+    return NULL;
+}
+
+// Index is kept at most half full, it is rebuilt twice as big when it fills up
+void add_function(Func fn, Location loc){
+    if(find_function(fn.name) != NULL){
+        printloc(loc);
+        logf(" Error: function '%.*s' is already defined\n", SVVARG(fn.name));
+        exit(1);
+    }
+    functions.funcs = realloc(functions.funcs, sizeof(Func)*(functions.funcc+1));
+    functions.funcs[functions.funcc++] = fn;
+    if(functions.funcc*2 > functions.index_cap){
+        functions.index_cap = functions.index_cap ? functions.index_cap*2 : 64;
+        free(functions.index);
+        functions.index = calloc(functions.index_cap, sizeof(size_t));
+        for(size_t id = 0; id<functions.funcc; id++){
+            size_t mask = functions.index_cap-1;
+            size_t i = hash(functions.funcs[id].name)&mask;
+            while(functions.index[i]){
+                i = (i+1)&mask;
             }
-            token = expr[++i];
-            Func fn_to_call = functions[hash(fn_token.sv)%1024];
-            fn_to_call.body.variables=malloc(sizeof(Variables)*10);
-            for(int i = 0; i<10; i++){
-                fn_to_call.body.variables[i].varc = 0;
+            functions.index[i] = id+1;
+        }
+        return;
+    }
+    size_t mask = functions.index_cap-1;
+    size_t i = hash(fn.name)&mask;
+    while(functions.index[i]){
+        i = (i+1)&mask;
+    }
+    functions.index[i] = functions.funcc;
+}
+
+FrameStack frame_stack = {0};
+
+// Pushes zeroed frame of slotc slots, chunks are kept for reuse after return
+Variable *push_frame(size_t slotc){
+    FrameStack *this = &frame_stack;
+    if(this->chunkc == 0 || this->chunks[this->current].top + slotc > this->chunks[this->current].cap){
+        if(this->chunkc > 0){
+            this->current++;
+        }
+        if(this->current == this->chunkc){
+            this->chunks = realloc(this->chunks, sizeof(FrameChunk)*(this->chunkc+1));
+            this->chunks[this->chunkc++] = (FrameChunk){0};
+        }
+        FrameChunk *chunk = &this->chunks[this->current];
+        if(chunk->slots == NULL || chunk->cap < slotc){
+            chunk->cap   = (slotc > FRAME_CHUNK_SLOTS) ? slotc : FRAME_CHUNK_SLOTS;
+            chunk->slots = realloc(chunk->slots, sizeof(Variable)*chunk->cap);
+        }
+    }
+    FrameChunk *chunk = &this->chunks[this->current];
+    Variable *frame = chunk->slots + chunk->top;
+    memset(frame, 0, sizeof(Variable)*slotc);
+    chunk->top += slotc;
+    return frame;
+}
+
+// Frees storage held by the frame and gives its slots back
+void pop_frame(Variable *frame, size_t slotc){
+    FrameStack *this = &frame_stack;
+    clear_slots(frame, 0, slotc);
+    this->chunks[this->current].top -= slotc;
+    if(this->chunks[this->current].top == 0 && this->current > 0){
+        this->current--;
+    }
+}
+
+void free_frame_stack(void){
+    for(size_t i = 0; i<frame_stack.chunkc; i++){
+        free(frame_stack.chunks[i].slots);
+    }
+    free(frame_stack.chunks);
+    frame_stack = (FrameStack){0};
+}
+
+// Binds argument j of call into var, arrays are borrowed unless copy is asked
+void bind_argument(Func *fn_to_call, size_t j, Expr *arg, Variable *frame, Variable *dst){
+    Token token = arg->token;
+    Variable var;
+    var.name     = fn_to_call->args[j].name;
+    var.type     = fn_to_call->args[j].type;
+    var.modifyer = fn_to_call->args[j].modifyer;
+    if(var.modifyer == MOD_ARRAY){
+        Variable *src = NULL;
+        if(arg->kind == EXPR_VAR){
+            src = &frame[arg->slot];
+        }
+        if(src == NULL || src->modifyer!=MOD_ARRAY){
+            printloc(token.loc);
+            logf(" Error: expected array as argument '%s %.*s[]'\n",
+                    TYPE_TO_STR[var.type], SVVARG(var.name));
+            exit(1);
+        }
+        if(var.type != src->type){
+            printloc(token.loc);
+            logf(" Error: expected '%s' array, got '%s'\n", TYPE_TO_STR[var.type], TYPE_TO_STR[src->type]);
+            exit(1);
+        }
+        var.size = src->size;
+        if(fn_to_call->args[j].copy){
+            var.ptr = malloc(get_type_size_in_bytes(var.type) * src->size);
+            copy_array(var, *src);
+        } else { // borrowed from caller
+            var.ptr = src->ptr;
+        }
+    } else { // if var not array
+        CBReturn argument_value = evaluate_expr(arg, frame);
+        global_location = token.loc;
+        var_cast(&var, argument_value);
+    }
+    *dst = var;
+}
+
+// Arguments of pending tail calls, stacked since evaluating them may run
+// other tail calls
+TailArgs tail_args = {0};
+
+// Binds arguments of 'return f(...)', function returning it runs f in its place
+CBReturn tail_call(Expr *call, Variable *frame){
+    Func *fn_to_call = call->call.fn;
+    size_t mark = tail_args.top;
+    tail_args.top += fn_to_call->argc;
+    if(tail_args.top > tail_args.cap){
+        tail_args.cap  = tail_args.top*2;
+        tail_args.args = realloc(tail_args.args, sizeof(Variable)*tail_args.cap);
+    }
+    for(size_t j = 0; j<fn_to_call->argc; j++){
+        Variable var;
+        bind_argument(fn_to_call, j, call->call.args[j], frame, &var);
+        tail_args.args[mark+j] = var;
+    }
+    return (CBReturn){.returned = true, .tail_call = fn_to_call};
+}
+
+// Runs function in its frame and pops it, tail calls take the place of the
+// frame instead of nesting, so they run in constant stack
+CBReturn evaluate_function(Func *fn, Variable *fn_frame){
+    if(tracing){
+        profile_enter(fn, global_location.row);
+    }
+    for(;;){
+        CBReturn ret = evaluate_code_block(fn->block, fn_frame);
+        for(size_t j = 0; j<fn->argc; j++){
+            if(fn->args[j].modifyer == MOD_ARRAY && !fn->args[j].copy){
+                fn_frame[j].ptr = NULL; // storage belongs to caller
             }
-            for(size_t j = 0; j<fn_to_call.argc; j++){
-                Variable var;
-                var.name     = fn_to_call.args[j].name;
-                var.type     = fn_to_call.args[j].type;
-                var.modifyer = fn_to_call.args[j].modifyer;
-                if(var.modifyer == MOD_ARRAY){
-                    Variable src = get_var_by_name(token.sv, variables, depth);
-                    if(src.modifyer!=MOD_ARRAY){
-                        printloc(token.loc);
-                        logf(" Error: expected array, got %s \n", TYPE_TO_STR[src.type]);
-                        exit(1);
-                    }
-                    var.size = src.size;
-                    var.ptr = malloc(get_type_size_in_bytes(var.type) * src.size);
-                    copy_array(var, src);
-                    token = expr[++i];
-                    token = expr[++i];
-                } else { // if var not array
-                    token = expr[i];
-                    Token *arg_expr_start = &expr[i];
-                    int arg_exprc = 0;
-                    for(int depth_level=1; token.type != TOKEN_COMMA && depth_level!=0;){
-                        if(token.type == TOKEN_CPAREN && depth_level==0){
-                            logf("Expected '%s %.*s' as argument, got nothing\n",
-                                        TYPE_TO_STR[var.type], SVVARG(var.name));
-                            TOKENERROR(" Error: uhhm, bruh. You forgor some arguments ")
-                        }
-                        token = expr[++i];
-                        switch(token.type){
-                            case TOKEN_OPAREN:depth_level++;break;
-                            case TOKEN_CPAREN:depth_level--;break;
-                            default:break;
-                        }
-                        arg_exprc++;
-                    }
-                    token = expr[++i];
-                    CBReturn argument_value = evaluate_expr(arg_expr_start, arg_exprc, variables, depth);
-                    var.ptr = malloc(get_type_size_in_bytes(var.type));
-                    var_cast(&var, argument_value);
-                }
-                if(variables[depth].varc == 0){
-                    fn_to_call.body.variables[1].variables = malloc(sizeof(Variable));
-                } else {
-                    fn_to_call.body.variables[1].variables =
-                        realloc(fn_to_call.body.variables[1].variables, sizeof(Variable)*(fn_to_call.body.variables[1].varc+1));
-                }
-                fn_to_call.body.variables[1].variables[j] = var;
-                fn_to_call.body.variables[1].varc++;
-                fn_to_call.body.depth = 1;
-            }
-            if(fn_to_call.name.data == NULL){
-                TOKENERROR(" Error: unknown directive ");
-            }
-            while(token.type != TOKEN_SEMICOLON){
-                token = expr[++i];
-            }
-            postfix[j].type = RPN_NUM;
-            postfix[j].numeric = evaluate_code_block(fn_to_call.body).num;
-            j++;
-            free(fn_to_call.body.variables);
-            break;
-            //-function-call-handling-
+        }
+        pop_frame(fn_frame, fn->slotc);
+        if(ret.tail_call == NULL){
+            if(tracing){
+                profile_leave();
             }
+            ret.returned = true;
+            return ret;
+        }
+        fn = ret.tail_call;
+        if(tracing){
+            profile_tail_call(fn, global_location.row);
+        }
+        fn_frame = push_frame(fn->slotc);
+        tail_args.top -= fn->argc;
+        memcpy(fn_frame, tail_args.args + tail_args.top, sizeof(Variable)*fn->argc);
+    }
+}
+
+// Tree-walker calls nest on the C stack, each call checks how much of it is
+// used and stops with an error before it runs out. The VM keeps its frames
+// on the heap, machine code calls nest on the C stack and go back to the VM
+// near the limit.
+uintptr_t stack_base = 0;
+size_t stack_limit = 0;
+
+void setup_stack_limit(void *base, size_t size){
+    // room for std functions, printf and frames below base
+    size_t reserve = (size > 4 << 20) ? 1 << 20 : size/4;
+    stack_base  = (uintptr_t)base;
+    stack_limit = size - reserve;
+}
+
+// Bytes of C stack between base and here, whichever way it grows
+size_t stack_used(void *here){
+    uintptr_t at = (uintptr_t)here;
+    return (at < stack_base) ? stack_base - at : at - stack_base;
+}
+
+size_t main_stack_size(void){
+#ifndef _WIN32
+    struct rlimit limit;
+    if(getrlimit(RLIMIT_STACK, &limit) == 0){
+        return (limit.rlim_cur == RLIM_INFINITY) ? TREE_WALK_STACK : limit.rlim_cur;
+    }
+#endif
+    return 1 << 20; // Windows default
+}
+
+void *tree_walk_thread(void *entry){
+    Func *fn = entry;
+    setup_stack_limit(&fn, TREE_WALK_STACK);
+    evaluate_function(fn, push_frame(fn->slotc));
+    return NULL;
+}
+
+// Runs main on a thread with a stack for deep recursion, its pages are
+// only used as recursion gets there. Main thread stack is the fallback.
+void run_tree_walk(Func *fn){
+#ifndef _WIN32
+    pthread_attr_t attr;
+    pthread_t thread;
+    if(pthread_attr_init(&attr) == 0){
+        bool started = pthread_attr_setstacksize(&attr, TREE_WALK_STACK) == 0
+                    && pthread_create(&thread, &attr, tree_walk_thread, fn) == 0;
+        pthread_attr_destroy(&attr);
+        if(started){
+            pthread_join(thread, NULL);
+            return;
+        }
+    }
+#endif
+    setup_stack_limit(&fn, main_stack_size());
+    evaluate_function(fn, push_frame(fn->slotc));
+}
+
+CBReturn call_function(Expr *call, Variable *frame){
+    Func *fn_to_call = call->call.fn;
+    if(stack_used(&fn_to_call) > stack_limit){
+        Token token = call->token;
+        RUNTIMEERROR(" Error: call stack exhausted, recursion is too deep for --tree-walk");
+    }
+    // arguments take the first slots of callee frame
+    Variable *fn_frame = push_frame(fn_to_call->slotc);
+    for(size_t j = 0; j<fn_to_call->argc; j++){
+        bind_argument(fn_to_call, j, call->call.args[j], frame, &fn_frame[j]);
+    }
+    return evaluate_function(fn_to_call, fn_frame);
+    //-function-call-handling-
+}
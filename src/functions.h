@@ -1,7 +1,22 @@
 #include "types.h"
 #ifndef _FUNCTIONS_H
 #define _FUNCTIONS_H
-void printloc(Location loc);
+extern Stats stats;
+extern bool print_stats;
+extern bool tracing;
+extern bool trace_statements;
+extern bool sampling;
+extern bool jit_enabled;
+extern bool emit_c;
+void profile_report(void);
+void setup_stats(void);
+void profile_switch(size_t row);
+void profile_statement(size_t row);
+void profile_enter(Func *fn, size_t row);
+void profile_leave(void);
+void profile_tail_call(Func *fn, size_t row);
+void sample_push(Func *fn, size_t row);
+void sample_pop(void);
 void debug_token(Token token);
 void debug_variable(Variable variable);
 void debug_block(CodeBlock block);
@@ -10,14 +25,30 @@ void usage(char *program_name);
 char *args_shift(int *argc, char ***argv);
 enum TypeEnum parse_type(Lexer *lexer);
 enum TypeEnum token_variable_type(Token token);
-ssize_t get_type_size_in_bytes(enum TypeEnum type);
-void var_cast(Variable *var, CBReturn src);
 Func parse_function(Lexer *lexer);
-ssize_t get_num_value(Variable var, Location loc);
-ssize_t get_arr_num_value(Variable var, size_t index);
-Variable get_var_by_name(SView sv, Variables *variables, ssize_t depth);
-CBReturn evaluate_expr(Token *expr, ssize_t expr_size, Variables *variables, size_t depth);
-bool evaluate_bool_expr(Token *expr, ssize_t expr_size, Variables *variables, size_t depth);
-CBReturn evaluate_code_block(CodeBlock block);
-CBReturn stdcall(Token *expr, size_t exprc, Variables *variables, size_t depth);
+Expr *parse_primary(Parser *this);
+Expr *parse_expr(Parser *this);
+Stmt parse_statement(Parser *this);
+Block parse_function_body(CodeBlock body);
+void resolve_function(Func *fn);
+bool optimize_function(Func *fn);
+void eliminate_bounds_checks(Func *fn);
+Func *find_function(SView name);
+void add_function(Func fn, Location loc);
+CBReturn evaluate_expr(Expr *expr, Variable *frame);
+bool evaluate_bool_expr(Expr *expr, Variable *frame);
+CBReturn evaluate_code_block(Block block, Variable *frame);
+CBReturn evaluate_stdcall(Expr *call, Variable *frame);
+CBReturn call_function(Expr *call, Variable *frame);
+CBReturn tail_call(Expr *call, Variable *frame);
+CBReturn evaluate_function(Func *fn, Variable *fn_frame);
+void compile_function(Func *fn);
+void debug_bytecode(Func *fn);
+ssize_t vm_execute(Func *fn, Instr *pc, size_t base);
+bool jit_compile(Func *fn);
+bool jit_ready(Func *fn);
+ssize_t jit_call(Func *fn, size_t base);
+Instr *jit_loop(Func *fn, Instr *pc, size_t base);
+void jit_free(Func *fn);
+void emit_c_program(char *file_path, Func *entry);
 #endif
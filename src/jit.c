@@ -0,0 +1,521 @@
+#if defined(__x86_64__) && !defined(_WIN32)
+#include <sys/mman.h>
+#define JIT_SUPPORTED
+#endif
+#include "types.h"
+#include "functions.h"
+
+// Tiering JIT: functions called JIT_HOT_CALLS times, and functions with a
+// loop body run JIT_HOT_LOOPS times, are translated from bytecode to
+// x86-64 code, one template per instruction. Machine code keeps values in
+// the VM registers of its frame, so it can stop before any instruction
+// and the interpreter goes on from there. Range, index and divisor checks
+// that fail, and instructions without a template, bail out this way, the
+// interpreter then runs the instruction again and reports errors exactly
+// as it always does.
+
+#ifdef JIT_SUPPORTED
+bool jit_enabled = true;
+#else
+bool jit_enabled = false;
+#endif
+Instr jit_return = {.op = OP_RET, .type = TYPE_I64, .a = 0};
+
+JitExit jit_enter(Func *fn, size_t at, size_t base){
+    return fn->jit.entry(fn->jit.code + fn->jit.offsets[at], base);
+}
+
+// Calls from machine code, and from the VM once the callee is compiled.
+// Machine code frames nest on the C stack, calls near its limit stay in the
+// interpreter, which does not use it.
+ssize_t jit_call(Func *fn, size_t base){
+    vm_reserve(base + fn->bytecode.regc);
+    ssize_t value;
+    if(stack_used(&value) <= stack_limit
+       && (fn->jit.entry != NULL || (--fn->jit.countdown == 0 && jit_compile(fn)))){
+        JitExit exit = jit_enter(fn, 0, base);
+        value = exit.pc == JIT_RETURNED ? exit.value
+                                        : vm_execute(fn, fn->bytecode.code + exit.pc, base);
+    } else {
+        value = vm_execute(fn, fn->bytecode.code, base);
+    }
+    return value;
+}
+
+// VM call whose countdown ran out, compiled functions keep it at 1
+bool jit_ready(Func *fn){
+    if(fn->jit.entry == NULL && !jit_compile(fn)){
+        return false;
+    }
+    fn->jit.countdown = 1;
+    return stack_used(&fn) <= stack_limit;
+}
+
+// Hot loop enters machine code in the middle of the function, loops of
+// functions that can not be compiled stop counting
+Instr *jit_loop(Func *fn, Instr *pc, size_t base){
+    Instr *loop = pc-1;
+    size_t at = pc - fn->bytecode.code;
+    if(fn->jit.entry == NULL && !jit_compile(fn)){
+        *loop = (Instr){.op = OP_JMP, .type = TYPE_I64, .b = at};
+        return pc;
+    }
+    loop->b = 1;
+    JitExit exit = jit_enter(fn, at, base);
+    if(exit.pc != JIT_RETURNED){
+        return fn->bytecode.code + exit.pc;
+    }
+    vm.stack[base].num = exit.value;
+    return &jit_return;
+}
+
+// Range checked instructions bail out with their operands unchanged
+void jit_stdcall(Func *fn, size_t at, size_t base){
+    Instr instr = fn->bytecode.code[at];
+    Token token = fn->bytecode.tokens[at];
+    Value *regs = vm.stack + base;
+    global_location = token.loc;
+    vm_stdcall(&fn->bytecode.stdcalls[instr.b], regs, &fn->bytecode, &regs[instr.a]);
+    if(regs[instr.a].num < TYPE_MIN[instr.type] || regs[instr.a].num > TYPE_MAX[instr.type]){
+        range_error(instr.type, token.sv, regs[instr.a].num);
+    }
+}
+
+#ifdef JIT_SUPPORTED
+// x86-64 encoding. rbx points at the registers of the frame, r12 holds
+// its base, rax, rcx and rdx are scratch.
+#define RAX 0
+#define RCX 1
+#define RDX 2
+#define RSI 6
+#define RDI 7
+#define JCC_ALWAYS 0xFF
+#define JCC_AE 0x3
+#define JCC_E  0x4
+#define JCC_NE 0x5
+#define JCC_L  0xC
+#define JCC_GE 0xD
+#define JCC_LE 0xE
+#define JCC_G  0xF
+#define JIT_EMIT(this, ...) jit_code(this, (uint8_t[]){__VA_ARGS__}, sizeof((uint8_t[]){__VA_ARGS__}))
+
+void jit_code(JitBuffer *this, uint8_t *bytes, size_t count){
+    if(this->size + count > this->cap){
+        this->cap  = this->cap ? this->cap*2 : 4096;
+        this->data = realloc(this->data, this->cap);
+    }
+    memcpy(this->data + this->size, bytes, count);
+    this->size += count;
+}
+
+void jit_u32(JitBuffer *this, uint32_t value){
+    jit_code(this, (uint8_t*)&value, sizeof(value));
+}
+
+void jit_u64(JitBuffer *this, uint64_t value){
+    jit_code(this, (uint8_t*)&value, sizeof(value));
+}
+
+// reg = [rbx + slot*8]
+void jit_load(JitBuffer *this, uint8_t reg, uint16_t slot){
+    JIT_EMIT(this, 0x48, 0x8B, 0x83 | reg<<3);
+    jit_u32(this, slot*8);
+}
+
+// [rbx + slot*8] = reg
+void jit_store(JitBuffer *this, uint16_t slot, uint8_t reg){
+    JIT_EMIT(this, 0x48, 0x89, 0x83 | reg<<3);
+    jit_u32(this, slot*8);
+}
+
+// reg op= [rbx + slot*8], op is add, sub or cmp
+void jit_alu(JitBuffer *this, uint8_t op, uint8_t reg, uint16_t slot){
+    JIT_EMIT(this, 0x48, op, 0x83 | reg<<3);
+    jit_u32(this, slot*8);
+}
+
+// reg = [base + offset]
+void jit_field(JitBuffer *this, uint8_t reg, uint8_t base, size_t offset){
+    JIT_EMIT(this, 0x48, 0x8B, 0x80 | reg<<3 | base);
+    jit_u32(this, offset);
+}
+
+void jit_imm(JitBuffer *this, uint8_t reg, int64_t value){
+    if(value >= INT32_MIN && value <= INT32_MAX){
+        JIT_EMIT(this, 0x48, 0xC7, 0xC0 | reg);
+        jit_u32(this, value);
+    } else {
+        JIT_EMIT(this, 0x48, 0xB8 | reg);
+        jit_u64(this, value);
+    }
+}
+
+void jit_jump(JitBuffer *this, uint8_t cond, size_t target, bool bail){
+    if(cond == JCC_ALWAYS){
+        JIT_EMIT(this, 0xE9);
+    } else {
+        JIT_EMIT(this, 0x0F, 0x80 | cond);
+    }
+    this->fixups = realloc(this->fixups, sizeof(JitFixup)*(this->fixupc+1));
+    this->fixups[this->fixupc++] = (JitFixup){.at = this->size, .target = target, .bail = bail};
+    jit_u32(this, 0);
+}
+
+// rbx = vm.stack + r12, the stack moves when a call grows it
+void jit_load_frame(JitBuffer *this){
+    JIT_EMIT(this, 0x48, 0xB9);
+    jit_u64(this, (uintptr_t)&vm.stack);
+    JIT_EMIT(this, 0x48, 0x8B, 0x19,         // mov rbx, [rcx]
+                   0x4A, 0x8D, 0x1C, 0xE3);  // lea rbx, [rbx + r12*8]
+}
+
+// pop r12, pop rbx, pop rbp, ret
+void jit_epilogue(JitBuffer *this){
+    JIT_EMIT(this, 0x41, 0x5C, 0x5B, 0x5D, 0xC3);
+}
+
+void jit_call_helper(JitBuffer *this, uintptr_t helper){
+    JIT_EMIT(this, 0x48, 0xB8);
+    jit_u64(this, helper);
+    JIT_EMIT(this, 0xFF, 0xD0);
+}
+
+// Jump forward inside one template, jit_land points it at the next byte
+size_t jit_forward(JitBuffer *this, uint8_t cond){
+    if(cond == JCC_ALWAYS){
+        JIT_EMIT(this, 0xE9);
+    } else {
+        JIT_EMIT(this, 0x0F, 0x80 | cond);
+    }
+    jit_u32(this, 0);
+    return this->size;
+}
+
+void jit_land(JitBuffer *this, size_t jump){
+    int32_t rel = this->size - jump;
+    memcpy(this->data + jump - 4, &rel, 4);
+}
+
+// --sample-profile pushes and pops frames of its shadow stack inline,
+// only a push that has to grow the stack calls the sampler
+void jit_profile(JitBuffer *this, Instr instr){
+    _Static_assert(sizeof(CallFrame) == 16, "frames are indexed by shift");
+    size_t slow = 0, done = 0;
+    if(!profiling && instr.a == PROFILE_RETURN){
+        JIT_EMIT(this, 0x48, 0xB9);                  // mov rcx, &call_stack
+        jit_u64(this, (uintptr_t)&call_stack);
+        JIT_EMIT(this, 0x48, 0xFF, 0x89);            // dec qword [rcx + framec]
+        jit_u32(this, offsetof(CallStack, framec));
+        return;
+    }
+    if(!profiling && instr.a == PROFILE_CALL){
+        JIT_EMIT(this, 0x48, 0xB9);                  // mov rcx, &call_stack
+        jit_u64(this, (uintptr_t)&call_stack);
+        JIT_EMIT(this, 0x48, 0x8B, 0x81);            // mov rax, [rcx + framec]
+        jit_u32(this, offsetof(CallStack, framec));
+        JIT_EMIT(this, 0x48, 0x3B, 0x81);            // cmp rax, [rcx + push_limit]
+        jit_u32(this, offsetof(CallStack, push_limit));
+        slow = jit_forward(this, JCC_AE);
+        JIT_EMIT(this, 0x48, 0x8B, 0x91);            // mov rdx, [rcx + frames]
+        jit_u32(this, offsetof(CallStack, frames));
+        JIT_EMIT(this, 0x48, 0xC1, 0xE0, 0x04,       // shl rax, 4
+                       0x48, 0x01, 0xC2);            // add rdx, rax
+        jit_imm(this, RAX, (uintptr_t)&functions.funcs[instr.b]);
+        JIT_EMIT(this, 0x48, 0x89, 0x02);            // mov [rdx], rax
+        jit_imm(this, RAX, instr.c);
+        JIT_EMIT(this, 0x48, 0x89, 0x42, 0x08,       // mov [rdx + 8], rax
+                       0x48, 0xFF, 0x81);            // inc qword [rcx + framec]
+        jit_u32(this, offsetof(CallStack, framec));
+        done = jit_forward(this, JCC_ALWAYS);
+        jit_land(this, slow);
+    }
+    jit_imm(this, RDI, instr.a);
+    jit_imm(this, RSI, instr.b);
+    jit_imm(this, RDX, instr.c);
+    jit_call_helper(this, (uintptr_t)vm_profile);
+    if(done){
+        jit_land(this, done);
+    }
+}
+
+// Bails out of instruction at when rax is out of range of type
+void jit_check(JitBuffer *this, enum TypeEnum type, size_t at){
+    ssize_t min = TYPE_MIN[type], max = TYPE_MAX[type];
+    if(min != INT64_MIN){
+        JIT_EMIT(this, 0x48, 0x3D); // cmp rax, imm32
+        jit_u32(this, min);
+        jit_jump(this, JCC_L, at, true);
+    }
+    if(max != INT64_MAX){
+        JIT_EMIT(this, 0x48, 0x3D);
+        jit_u32(this, max);
+        jit_jump(this, JCC_G, at, true);
+    }
+}
+
+// rcx = array in reg arr, rdx = index in reg index, bails out when out of range
+void jit_index(JitBuffer *this, uint16_t arr, uint16_t index, bool checked, size_t at){
+    jit_load(this, RCX, arr);
+    jit_load(this, RDX, index);
+    if(checked){
+        JIT_EMIT(this, 0x48, 0x3B, 0x91); // cmp rdx, [rcx + size]
+        jit_u32(this, offsetof(Variable, size));
+        jit_jump(this, JCC_AE, at, true);
+    }
+}
+
+void jit_loadidx(JitBuffer *this, Instr instr, enum TypeEnum type, bool checked, size_t at){
+    jit_index(this, instr.b, instr.c, checked, at);
+    jit_field(this, RAX, RCX, offsetof(Variable, ptr));
+    switch(type){
+        case TYPE_I8:  JIT_EMIT(this, 0x48, 0x0F, 0xBE, 0x04, 0x10); break; // movsx rax, byte [rax + rdx]
+        case TYPE_I32: JIT_EMIT(this, 0x48, 0x63, 0x04, 0x90);       break; // movsxd rax, dword [rax + rdx*4]
+        default:       JIT_EMIT(this, 0x48, 0x8B, 0x04, 0xD0);       break; // mov rax, [rax + rdx*8]
+    }
+    jit_store(this, instr.a, RAX);
+}
+
+void jit_storeidx(JitBuffer *this, Instr instr, enum TypeEnum type, bool checked, size_t at){
+    jit_index(this, instr.a, instr.b, checked, at);
+    jit_load(this, RAX, instr.c);
+    jit_check(this, instr.type, at);
+    jit_field(this, RCX, RCX, offsetof(Variable, ptr));
+    switch(type){
+        case TYPE_I8:  JIT_EMIT(this, 0x88, 0x04, 0x11);       break; // mov [rcx + rdx], al
+        case TYPE_I32: JIT_EMIT(this, 0x89, 0x04, 0x91);       break; // mov [rcx + rdx*4], eax
+        default:       JIT_EMIT(this, 0x48, 0x89, 0x04, 0xD1); break; // mov [rcx + rdx*8], rax
+    }
+}
+
+// rax = b op c, a = rax
+void jit_arith(JitBuffer *this, Instr instr, size_t at){
+    jit_load(this, RAX, instr.b);
+    switch(instr.op){
+        case OP_ADD:  jit_alu(this, 0x03, RAX, instr.c); break;
+        case OP_SUB:  jit_alu(this, 0x2B, RAX, instr.c); break;
+        case OP_ADDI: JIT_EMIT(this, 0x48, 0x05); jit_u32(this, instr.c); break;
+        case OP_MUL:
+            JIT_EMIT(this, 0x48, 0x0F, 0xAF, 0x83); // imul rax, [rbx + c*8]
+            jit_u32(this, instr.c*8);
+            break;
+        default: // div and mod, the interpreter reports zero and traps on -1 overflow as before
+            jit_load(this, RCX, instr.c);
+            JIT_EMIT(this, 0x48, 0x85, 0xC9);        // test rcx, rcx
+            jit_jump(this, JCC_E, at, true);
+            JIT_EMIT(this, 0x48, 0x83, 0xF9, 0xFF);  // cmp rcx, -1
+            jit_jump(this, JCC_E, at, true);
+            JIT_EMIT(this, 0x48, 0x99,               // cqo
+                           0x48, 0xF7, 0xF9);        // idiv rcx
+            if(instr.op == OP_MOD){
+                JIT_EMIT(this, 0x48, 0x89, 0xD0);    // mov rax, rdx
+            }
+    }
+    jit_check(this, instr.type, at);
+    jit_store(this, instr.a, RAX);
+}
+
+void jit_compare(JitBuffer *this, Instr instr, uint8_t cond){
+    jit_load(this, RAX, instr.b);
+    jit_alu(this, 0x3B, RAX, instr.c);
+    JIT_EMIT(this, 0x0F, 0x90 | cond, 0xC0,  // setcc al
+                   0x0F, 0xB6, 0xC0);        // movzx eax, al
+    jit_store(this, instr.a, RAX);
+}
+
+void jit_branch(JitBuffer *this, Instr instr, uint8_t cond){
+    jit_load(this, RAX, instr.a);
+    jit_alu(this, 0x3B, RAX, instr.b);
+    jit_jump(this, cond, instr.c, false);
+}
+
+void jit_constant(JitBuffer *this, Instr instr, ssize_t value, size_t at){
+    if(value < TYPE_MIN[instr.type] || value > TYPE_MAX[instr.type]){
+        jit_jump(this, JCC_ALWAYS, at, true);
+        return;
+    }
+    jit_imm(this, RAX, value);
+    jit_store(this, instr.a, RAX);
+}
+
+void jit_instr(JitBuffer *this, Func *fn, size_t at){
+    Bytecode *bc = &fn->bytecode;
+    Instr instr = bc->code[at];
+    switch(instr.op){
+        case OP_LOADI: jit_constant(this, instr, instr.b, at);            break;
+        case OP_LOADK: jit_constant(this, instr, bc->consts[instr.b], at); break;
+        case OP_LOADSTR:
+            jit_imm(this, RAX, (uintptr_t)&bc->strings[instr.b]);
+            jit_store(this, instr.a, RAX);
+            break;
+        case OP_MOV:
+            jit_load(this, RAX, instr.b);
+            jit_check(this, instr.type, at);
+            jit_store(this, instr.a, RAX);
+            break;
+        case OP_ADD: case OP_ADDI: case OP_SUB: case OP_MUL: case OP_DIV: case OP_MOD:
+            jit_arith(this, instr, at);
+            break;
+        case OP_LESS:       jit_compare(this, instr, JCC_L);  break;
+        case OP_LESS_EQ:    jit_compare(this, instr, JCC_LE); break;
+        case OP_GREATER:    jit_compare(this, instr, JCC_G);  break;
+        case OP_GREATER_EQ: jit_compare(this, instr, JCC_GE); break;
+        case OP_EQ:         jit_compare(this, instr, JCC_E);  break;
+        case OP_NOT_EQ:     jit_compare(this, instr, JCC_NE); break;
+        case OP_JMP:
+            jit_jump(this, JCC_ALWAYS, instr.b, false);
+            break;
+        case OP_JZ:
+        case OP_JNZ:
+            JIT_EMIT(this, 0x48, 0x83, 0xBB); // cmp qword [rbx + a*8], 0
+            jit_u32(this, instr.a*8);
+            JIT_EMIT(this, 0x00);
+            jit_jump(this, instr.op == OP_JZ ? JCC_E : JCC_NE, instr.b, false);
+            break;
+        case OP_JLESS:       jit_branch(this, instr, JCC_L);  break;
+        case OP_JLESS_EQ:    jit_branch(this, instr, JCC_LE); break;
+        case OP_JGREATER:    jit_branch(this, instr, JCC_G);  break;
+        case OP_JGREATER_EQ: jit_branch(this, instr, JCC_GE); break;
+        case OP_JEQ:         jit_branch(this, instr, JCC_E);  break;
+        case OP_JNOT_EQ:     jit_branch(this, instr, JCC_NE); break;
+        case OP_LEN:
+            jit_load(this, RCX, instr.b);
+            jit_field(this, RAX, RCX, offsetof(Variable, size));
+            jit_check(this, instr.type, at);
+            jit_store(this, instr.a, RAX);
+            break;
+        case OP_LOADIDX_I8:    jit_loadidx(this, instr, TYPE_I8, true, at);    break;
+        case OP_LOADIDX_I32:   jit_loadidx(this, instr, TYPE_I32, true, at);   break;
+        case OP_LOADIDX_I64:   jit_loadidx(this, instr, TYPE_I64, true, at);   break;
+        case OP_LOADIDXU_I8:   jit_loadidx(this, instr, TYPE_I8, false, at);   break;
+        case OP_LOADIDXU_I32:  jit_loadidx(this, instr, TYPE_I32, false, at);  break;
+        case OP_LOADIDXU_I64:  jit_loadidx(this, instr, TYPE_I64, false, at);  break;
+        case OP_STOREIDX_I8:   jit_storeidx(this, instr, TYPE_I8, true, at);   break;
+        case OP_STOREIDX_I32:  jit_storeidx(this, instr, TYPE_I32, true, at);  break;
+        case OP_STOREIDX_I64:  jit_storeidx(this, instr, TYPE_I64, true, at);  break;
+        case OP_STOREIDXU_I8:  jit_storeidx(this, instr, TYPE_I8, false, at);  break;
+        case OP_STOREIDXU_I32: jit_storeidx(this, instr, TYPE_I32, false, at); break;
+        case OP_STOREIDXU_I64: jit_storeidx(this, instr, TYPE_I64, false, at); break;
+        case OP_CALL:
+            JIT_EMIT(this, 0x48, 0xBF);              // mov rdi, callee
+            jit_u64(this, (uintptr_t)&functions.funcs[instr.b]);
+            JIT_EMIT(this, 0x4C, 0x89, 0xE6,         // mov rsi, r12
+                           0x48, 0x81, 0xC6);        // add rsi, c
+            jit_u32(this, instr.c);
+            jit_call_helper(this, (uintptr_t)jit_call);
+            JIT_EMIT(this, 0x48, 0x89, 0xC2);        // mov rdx, rax
+            jit_load_frame(this);
+            jit_store(this, instr.a, RDX);
+            break;
+        case OP_TAILCALL: // only calls of itself become a jump, arguments move down
+            if(&functions.funcs[instr.b] != fn){
+                jit_jump(this, JCC_ALWAYS, at, true);
+                break;
+            }
+            for(size_t i = 0; i<fn->argc; i++){
+                jit_load(this, RAX, instr.c+i);
+                jit_store(this, i, RAX);
+            }
+            jit_jump(this, JCC_ALWAYS, 0, false);
+            break;
+        case OP_STDCALL:
+            JIT_EMIT(this, 0x48, 0xBF);              // mov rdi, fn
+            jit_u64(this, (uintptr_t)fn);
+            JIT_EMIT(this, 0xBE);                    // mov esi, at
+            jit_u32(this, at);
+            JIT_EMIT(this, 0x4C, 0x89, 0xE2);        // mov rdx, r12
+            jit_call_helper(this, (uintptr_t)jit_stdcall);
+            break;
+        case OP_RET:
+        case OP_RETV:
+            if(instr.op == OP_RET){
+                jit_load(this, RDX, instr.a);
+            } else {
+                JIT_EMIT(this, 0x31, 0xD2);          // xor edx, edx
+            }
+            jit_imm(this, RAX, -1);                  // JIT_RETURNED
+            jit_epilogue(this);
+            break;
+        case OP_PROFILE: // calls and returns for --sample-profile
+            jit_profile(this, instr);
+            break;
+        case OP_LOOP:
+            break;
+        default: // arrays are allocated and freed by the interpreter
+            jit_jump(this, JCC_ALWAYS, at, true);
+    }
+}
+
+// Entry takes the address to start at and the frame base:
+// push rbp, mov rbp, rsp, push rbx, push r12, mov r12, rsi
+void jit_prologue(JitBuffer *this){
+    JIT_EMIT(this, 0x55, 0x48, 0x89, 0xE5, 0x53, 0x41, 0x54, 0x49, 0x89, 0xF4);
+    jit_load_frame(this);
+    JIT_EMIT(this, 0xFF, 0xE7); // jmp rdi
+}
+
+bool jit_compile(Func *fn){
+    if(fn->jit.failed){
+        return false;
+    }
+    Bytecode *bc = &fn->bytecode;
+    JitBuffer buffer = {0};
+    JitBuffer *this = &buffer;
+    size_t *offsets = malloc(sizeof(size_t)*bc->codec);
+    size_t *bails = calloc(bc->codec, sizeof(size_t));
+    jit_prologue(this);
+    for(size_t i = 0; i<bc->codec; i++){
+        offsets[i] = this->size;
+        jit_instr(this, fn, i);
+    }
+    // bail out: mov eax, at, return to the interpreter
+    for(size_t i = 0; i<this->fixupc; i++){
+        JitFixup fixup = this->fixups[i];
+        if(fixup.bail && bails[fixup.target] == 0){
+            bails[fixup.target] = this->size;
+            JIT_EMIT(this, 0xB8);
+            jit_u32(this, fixup.target);
+            jit_epilogue(this);
+        }
+    }
+    for(size_t i = 0; i<this->fixupc; i++){
+        JitFixup fixup = this->fixups[i];
+        size_t target = fixup.bail ? bails[fixup.target] : offsets[fixup.target];
+        int32_t rel = target - (fixup.at + 4);
+        memcpy(this->data + fixup.at, &rel, sizeof(rel));
+    }
+    free(bails);
+    free(this->fixups);
+    uint8_t *code = mmap(NULL, this->size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(code == MAP_FAILED){
+        free(this->data);
+        free(offsets);
+        fn->jit.failed = true;
+        return false;
+    }
+    memcpy(code, this->data, this->size);
+    free(this->data);
+    mprotect(code, this->size, PROT_READ | PROT_EXEC);
+    fn->jit.code    = code;
+    fn->jit.size    = this->size;
+    fn->jit.offsets = offsets;
+    memcpy(&fn->jit.entry, &code, sizeof(code)); // ISO C has no cast from data to function pointer
+    fn->jit.countdown = 1;
+    return true;
+}
+
+void jit_free(Func *fn){
+    if(fn->jit.code != NULL){
+        munmap(fn->jit.code, fn->jit.size);
+        free(fn->jit.offsets);
+    }
+}
+#else
+bool jit_compile(Func *fn){
+    fn->jit.failed = true;
+    return false;
+}
+
+void jit_free(Func *fn){
+    (void)fn;
+}
+#endif
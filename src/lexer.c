@@ -27,6 +27,63 @@ void lexer_drop_line(Lexer *this) {
     }
 }
 
+#define KEYWORD(word, token, vtype) \
+    if(memcmp(sv.data, word, sizeof(word)-1) == 0){ \
+        *var_type = vtype; \
+        return token; \
+    }
+
+// Classifies keywords and type names by length and first char,
+// so an identifier is compared with at most two words
+enum TokenEnum lexer_keyword(SView sv, enum TypeEnum *var_type){
+    switch(sv.size){
+        case 2:
+            switch(sv.data[0]){
+                case 'f': KEYWORD("fn", TOKEN_FN_DECL, TYPE_NOT_A_TYPE); break;
+                case 'i': KEYWORD("if", TOKEN_IF, TYPE_NOT_A_TYPE);
+                          KEYWORD("i8", TOKEN_TYPE, TYPE_I8); break;
+                case 'u': KEYWORD("u8", TOKEN_TYPE, TYPE_U8); break;
+            }
+            break;
+        case 3:
+            switch(sv.data[0]){
+                case 'f': KEYWORD("for", TOKEN_FOR, TYPE_NOT_A_TYPE); break;
+                case 's': KEYWORD("std", TOKEN_STD, TYPE_NOT_A_TYPE); break;
+                case 'i': KEYWORD("i32", TOKEN_TYPE, TYPE_I32);
+                          KEYWORD("i64", TOKEN_TYPE, TYPE_I64); break;
+                case 'u': KEYWORD("u32", TOKEN_TYPE, TYPE_U32);
+                          KEYWORD("u64", TOKEN_TYPE, TYPE_U64); break;
+            }
+            break;
+        case 4:
+            switch(sv.data[0]){
+                case 'e': KEYWORD("else", TOKEN_ELSE, TYPE_NOT_A_TYPE); break;
+                case 't': KEYWORD("true", TOKEN_TRUE, TYPE_NOT_A_TYPE); break;
+                case 'v': KEYWORD("void", TOKEN_VOID, TYPE_VOID); break;
+            }
+            break;
+        case 5:
+            switch(sv.data[0]){
+                case 'w': KEYWORD("while", TOKEN_WHILE, TYPE_NOT_A_TYPE); break;
+                case 'b': KEYWORD("break", TOKEN_BREAK, TYPE_NOT_A_TYPE); break;
+                case 'f': KEYWORD("false", TOKEN_FALSE, TYPE_NOT_A_TYPE); break;
+            }
+            break;
+        case 6:
+            switch(sv.data[0]){
+                case 'r': KEYWORD("return", TOKEN_RETURN, TYPE_NOT_A_TYPE); break;
+                case 's': KEYWORD("string", TOKEN_TYPE, TYPE_STRING); break;
+            }
+            break;
+        case 8:
+            KEYWORD("continue", TOKEN_CONTINUE, TYPE_NOT_A_TYPE);
+            break;
+    }
+    *var_type = TYPE_NOT_A_TYPE;
+    return TOKEN_NAME;
+}
+#undef KEYWORD
+
 Token lexer_next_token(Lexer *this){
     lexer_trim_left(this);
     SView sv = {0};
@@ -43,6 +100,9 @@ Token lexer_next_token(Lexer *this){
                     .file_path = this->file_name};
 
     sv.data = this->source+this->pos;
+    if(first_char=='\0'){
+        return (Token){.loc=loc, .sv=sv, .type=TOKEN_EOF};
+    }
     size_t start = this->pos;
     enum TokenEnum token_type;
     if(isalpha(first_char)){
@@ -50,32 +110,9 @@ Token lexer_next_token(Lexer *this){
            lexer_chop_char(this);
         }
         sv.size = this->pos - start;
-        if(SVCMP(sv, "fn")==0){
-            token_type = TOKEN_FN_DECL;
-        } else if(SVCMP(sv, "return")==0){
-            token_type = TOKEN_RETURN;
-        } else if(SVCMP(sv, "while")==0){
-            token_type = TOKEN_WHILE;
-        } else if(SVCMP(sv, "for")==0){
-            token_type = TOKEN_FOR;
-        } else if(SVCMP(sv, "continue")==0){
-            token_type = TOKEN_CONTINUE;
-        } else if(SVCMP(sv, "break")==0){
-            token_type = TOKEN_BREAK;
-        } else if(SVCMP(sv, "if")==0){
-            token_type = TOKEN_IF;
-        } else if(SVCMP(sv, "else")==0){
-            token_type = TOKEN_ELSE;
-        } else if(SVCMP(sv, "true")==0){
-            token_type = TOKEN_TRUE;
-        } else if(SVCMP(sv, "false")==0){
-            token_type = TOKEN_FALSE;
-        } else if(SVCMP(sv, "void")==0){
-            token_type = TOKEN_VOID;
-        } else {
-            token_type = TOKEN_NAME;
-        }
-        return (Token){.loc=loc, .sv=sv, .type=token_type};
+        enum TypeEnum var_type;
+        token_type = lexer_keyword(sv, &var_type);
+        return (Token){.loc=loc, .sv=sv, .type=token_type, .var_type=var_type};
     }
     if(isdigit(first_char)){
         while(CURR!='\0' && isdigit(CURR)) {
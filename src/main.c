@@ -5,20 +5,28 @@
 #include <stdbool.h>
 #include <stdint.h>
 #include <ctype.h>
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/resource.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
 
 #include "types.h"
 #include "lexer.c"
 #include "functions.h"
+#include "parser.c"
+#include "resolver.c"
+#include "optimizer.c"
+#include "runtime.c"
+#include "simd.c"
 #include "cbrstdlib.c"
+#include "profiler.c"
+#include "sampler.c"
 
-
-Location global_location;
-
-Func functions[1024] = {0};
-
-void printloc(Location loc){
-    logf("%s:%lu:%lu", loc.file_path, loc.row, loc.col);
-}
+FuncTable functions = {0};
 
 void debug_token(Token token){
     logf("Token {\n");
@@ -38,7 +46,7 @@ void debug_variable(Variable variable){
         for(size_t i=0; i<variable.size; i++){
             logf("%zd, ", get_arr_num_value(variable, i));
         }
-        puts("}");
+        logf("}\n");
     } else {
         logf("\tvalue: %zd\n", get_num_value(variable, (Location){0}));
     }
@@ -54,11 +62,9 @@ void debug_variables(Variables variables){
 
 void debug_block(CodeBlock block){
     logf("Block {\n");
-    logf("\tdepth: %d\n", block.depth);
     logf("\texprc: %zu\n", block.exprc);
-    logf("\tVariables: {\n");
-    for(size_t i = 0; i<block.variables[block.depth].varc; i++){
-        debug_variable(block.variables[block.depth].variables[i]);
+    for(size_t i = 0; i<block.exprc; i++){
+        logf("\t%.*s\n", SVVARG(block.code[i].sv));
     }
     logf("}\n");
 }
@@ -80,180 +86,44 @@ size_t hash(SView sv){
 void usage(char *program_name){
     logf("usage: %s [flags] <filename.cbr>\n", program_name);
     logf("flags:\n");
-    logf("\t--verbose : provides additional info\n");
-}
-// TODO: verbose output on error
-bool verbose = false;
-
-enum TypeEnum parse_type(Lexer *lexer){
-    Token token = lexer_next_token(lexer);
-    enum TypeEnum type;
-    if(SVCMP(token.sv, "i8")==0){
-        type = TYPE_I8;
-    } else if(SVCMP(token.sv, "i32")==0){
-        type = TYPE_I32;
-    } else if(SVCMP(token.sv, "i64")==0){
-        type = TYPE_I64;
-    } else if(SVCMP(token.sv, "u8")==0){
-        type = TYPE_U8;
-    } else if(SVCMP(token.sv, "u32")==0){
-        type = TYPE_U32;
-    } else if(SVCMP(token.sv, "u64")==0){
-        type = TYPE_U64;
-    } else if(SVCMP(token.sv, "string")==0){
-        type = TYPE_STRING;
-    } else if(SVCMP(token.sv, "void")==0){
-        type = TYPE_VOID;
-    } else {
-        TOKENERROR(" Error: unknown type ");
-    }
-    return type;
+    logf("\t--verbose   : provides additional info\n");
+    logf("\t--tree-walk : evaluate syntax trees instead of running bytecode\n");
+    logf("\t--dump-optimized : show constants folded and branches removed at load time\n");
+    logf("\t--unbuffered : write program output as soon as it is printed\n");
+    logf("\t--profile  : count statements and time lines and functions, report at exit\n");
+    logf("\t--stats    : print interpreter counters as JSON to stderr at exit\n");
+    logf("\t--sample-profile=<hz> : sample user call stacks hz times per cpu second, print folded stacks to stderr at exit\n");
+    logf("\t--no-jit   : never compile hot functions and loops to machine code\n");
+    logf("\t--emit-c   : write the program as C to stdout, build it with 'cc -O2 prog.c'\n");
+    logf("\t--simd=<scalar|sse2|avx2> : highest instruction set used by array functions\n");
 }
+bool tree_walk = false;
+enum SimdLevel simd_max = SIMD_AVX2;
 
 enum TypeEnum token_variable_type(Token token){
-    enum TypeEnum type;
-    if(SVCMP(token.sv, "i8")==0){
-        type = TYPE_I8;
-    } else if(SVCMP(token.sv, "i32")==0){
-        type = TYPE_I32;
-    } else if(SVCMP(token.sv, "i64")==0){
-        if(sizeof(size_t)!=8){
-            TOKENERROR(" Error: i64 not supported on this architecture");
-        }
-        type = TYPE_I64;
-    } else if(SVCMP(token.sv, "u8")==0){
-        type = TYPE_U8;
-    } else if(SVCMP(token.sv, "u32")==0){
-        type = TYPE_U32;
-    } else if(SVCMP(token.sv, "u64")==0){
-        type = TYPE_U64;
-    } else if(SVCMP(token.sv, "string")==0){
-        type = TYPE_STRING;
-    } else {
-        type = TYPE_NOT_A_TYPE;
+    if(token.type != TOKEN_TYPE){
+        return TYPE_NOT_A_TYPE;
     }
-    return type;
-}
-
-ssize_t get_type_size_in_bytes(enum TypeEnum type){
-    switch(type){
-        case TYPE_I8:
-        case TYPE_U8:
-            return 1;
-        case TYPE_I32:
-        case TYPE_U32:
-            return 4;
-        case TYPE_I64:
-        case TYPE_U64:
-            return 8;
-        case TYPE_STRING:
-            return sizeof(Variable);
-        default:
-           return -1;
-    }
-}
-
-// Cast int to variable
-void var_cast(Variable *var, CBReturn src){
-    // variables that track over- and under-flows of integer types
-    bool overflow = false;
-    bool underflow = false;
-    // Type checking
-    // * mostly, assignation occurs on result of evaluate_expr function, which MUST calculate type of expression
-    // * if expression is numeric, that it can be assigned to anything that is not overflow or underflowed
-    if(src.type != var->type && src.type!=TYPE_NUMERIC){
-        printloc(global_location);
-        logf(" Error on assignation of '%s %.*s' to type '%s'\n",
-                TYPE_TO_STR[var->type],
-                SVVARG(var->name),
-                TYPE_TO_STR[src.type]);
-        exit(1);
-    }
-    switch(var->type){
-        case TYPE_STRING:
-            var->ptr = src.string.data;
-            var->size = src.string.size;
-            break;
-        case TYPE_I8:
-            if(src.num>INT8_MAX){
-                overflow = true;
-                break;
-            } else if(src.num<INT8_MIN){
-                underflow = true;
-                break;
-            }
-            *(int8_t*)var->ptr = src.num;
-            break;
-        case TYPE_I32:
-            if(src.num>INT32_MAX){
-                overflow = true;
-                break;
-            } else if(src.num<INT32_MIN){
-                underflow = true;
-                break;
-            }
-            *(int32_t*)var->ptr = src.num;
-            break;
-        case TYPE_I64:
-            *(ssize_t*)var->ptr = src.num;
-            break;
-        default:
-           logf("ERROR: i8 i32 i64 and string types supported for assignement\n");
-           printloc(global_location);
-           exit(1);
+    if(token.var_type == TYPE_I64 && sizeof(size_t)!=8){
+        TOKENERROR(" Error: i64 not supported on this architecture");
     }
-    if(overflow||underflow){
-        logf("Error on assignation, %s %s in (tried assigning %zd to '%.*s')\n",
-                TYPE_TO_STR[var->type],
-                (underflow)?"underflow":"overflow",
-                src.num, SVVARG(var->name));
-        if(verbose){
-            logf("Type %s value range is ", TYPE_TO_STR[var->type]);
-            switch(var->type){
-                case TYPE_I8:
-                    logf("[%d;%d]\n", INT8_MIN, INT8_MAX);
-                    break;
-                case TYPE_I32:
-                    logf("[%d;%d]\n", INT32_MIN, INT32_MAX);
-                    break;
-                case TYPE_I64:
-                    logf("[%zu;%zu]\n", INT64_MIN, INT64_MAX);
-                    break;
-                default:break;
-            }
-        }
-        exit(1);
+    // no range checks or storage for these yet, they would run as unchecked i64
+    if(token.var_type == TYPE_U8 || token.var_type == TYPE_U32 || token.var_type == TYPE_U64){
+        TOKENERROR(" Error: unsigned types are not supported, got ");
     }
+    return token.var_type;
 }
 
-void copy_array(Variable dst, Variable src){
-    if(dst.type!=src.type){
-        logf("ERROR: array copying types mismatch\n");
-        logf("tried assigning %s[%zd] to %s[%zd]\n", TYPE_TO_STR[src.type], src.size, TYPE_TO_STR[dst.type], dst.size);
-        exit(1);
+// return type of function, type names are classified by lexer
+enum TypeEnum parse_type(Lexer *lexer){
+    Token token = lexer_next_token(lexer);
+    if(token.type != TOKEN_TYPE && token.type != TOKEN_VOID){
+        TOKENERROR(" Error: unknown type ");
     }
-    switch(src.type){
-        case TYPE_STRING:
-        case TYPE_I8:
-            for(size_t i=0; i<src.size; i++){
-                *((int8_t*)dst.ptr+i) = *((int8_t*)src.ptr+i);
-            }
-            break;
-        case TYPE_I32:
-            for(size_t i=0; i<src.size; i++){
-                *((int32_t*)dst.ptr+i) = *((int32_t*)src.ptr+i);
-            }
-            break;
-        case TYPE_I64:
-            for(size_t i=0; i<src.size; i++){
-                *((ssize_t*)dst.ptr+i) = *((ssize_t*)src.ptr+i);
-            }
-            break;
-        default:
-           logf("EROR: i8 i32 i64 types supported for get_num_value\n");
-           exit(1);
+    if(token.type == TOKEN_TYPE){
+        return token_variable_type(token);
     }
-    ;
+    return token.var_type;
 }
 
 Func parse_function(Lexer *lexer){
@@ -264,7 +134,7 @@ Func parse_function(Lexer *lexer){
     if(token.type!=TOKEN_OPAREN){
         TOKENERROR(" Error: expected '(', got ");
     }
-    func.args = malloc(sizeof(Var_signature)*10);
+    size_t arg_cap = 0;
     token = lexer_next_token(lexer);
     while(token.type!=TOKEN_CPAREN){
         enum TypeEnum type = token_variable_type(token);      // getting type
@@ -275,12 +145,21 @@ Func parse_function(Lexer *lexer){
         SView argname = token.sv;
         token=lexer_next_token(lexer); // var modifyer || comma
         enum ModifyerEnum mod = MOD_NO_MOD;
+        bool copy = false;
         if(token.type == TOKEN_OSQUAR){
             mod = MOD_ARRAY;
             token=lexer_next_token(lexer); // arg was arr => next_token == ']'
             token = lexer_next_token(lexer); // if arg was arr -> get comma as token => next_token == ','
+            if(token.type == TOKEN_NAME && SVCMP(token.sv, "copy") == 0){ // i8 a[] copy
+                copy = true;
+                token = lexer_next_token(lexer);
+            }
+        }
+        Var_signature vs = {.name=argname, .type = type, .modifyer=mod, .copy=copy};
+        if(func.argc >= arg_cap){
+            arg_cap = arg_cap ? arg_cap*2 : 8;
+            func.args = realloc(func.args, sizeof(Var_signature)*arg_cap);
         }
-        Var_signature vs = {.name=argname, .type = type, .modifyer=mod};
         func.args[func.argc] = vs;
         func.argc++;
         if(token.type==TOKEN_COMMA&&token.type!=TOKEN_CPAREN){
@@ -295,723 +174,482 @@ Func parse_function(Lexer *lexer){
     if(token.type!=TOKEN_OCURLY){
         TOKENERROR(" Error: expected '{', got ");
     }
-    int depth_level = 1;
-    func.body.code = malloc(sizeof(Token)*50);
-    for(int i=0, e = 50; token.type!=TOKEN_CCURLY || depth_level>0; i++){
-        if(i>=e){
-            e+=50;
-            func.body.code = realloc(func.body.code, e*sizeof(Token));
-        }
+    // collect body tokens up to the closing '}', pairing brackets on the way
+    Token fn_curly = token;
+    size_t *open = NULL;
+    size_t openc = 0;
+    size_t cap = 0;
+    for(;;){
         token = lexer_next_token(lexer);
-        func.body.code[i] = token;
-        func.body.exprc++;
-        switch(token.type){
-            case TOKEN_OCURLY:depth_level++;break;
-            case TOKEN_CCURLY:depth_level--;break;
-            default:break;
+        if(token.type == TOKEN_EOF){
+            token = openc ? func.body.code[open[openc-1]] : fn_curly;
+            TOKENERROR(" Error: unclosed bracket ");
+        }
+        if(func.body.exprc >= cap){
+            cap = cap ? cap*2 : 64;
+            func.body.code  = realloc(func.body.code, cap*sizeof(Token));
+            func.body.pairs = realloc(func.body.pairs, cap*sizeof(size_t));
+            open = realloc(open, cap*sizeof(size_t));
+        }
+        size_t i = func.body.exprc++;
+        func.body.code[i]  = token;
+        func.body.pairs[i] = i;
+        if(token.type == TOKEN_OCURLY || token.type == TOKEN_OPAREN || token.type == TOKEN_OSQUAR){
+            open[openc++] = i;
+        } else if(token.type == TOKEN_CCURLY || token.type == TOKEN_CPAREN || token.type == TOKEN_CSQUAR){
+            if(openc == 0){
+                if(token.type != TOKEN_CCURLY){
+                    TOKENERROR(" Error: unbalanced bracket ");
+                }
+                break; // end of function
+            }
+            size_t j = open[--openc];
+            char *expected = (func.body.code[j].type == TOKEN_OCURLY) ? "}" :
+                             (func.body.code[j].type == TOKEN_OPAREN) ? ")" : "]";
+            if(token.sv.data[0] != expected[0]){
+                printloc(token.loc);
+                logf(" Error: unbalanced bracket, expected '%s', got '%.*s'\n", expected, SVVARG(token.sv));
+                exit(1);
+            }
+            func.body.pairs[i] = j;
+            func.body.pairs[j] = i;
         }
     }
+    free(open);
+    func.block = parse_function_body(func.body);
     return func;
 }
 
-ssize_t get_num_value(Variable var, Location loc){
-    ssize_t value = 0;
-    switch(var.type){
-        case TYPE_I8:
-            value = *(int8_t*)var.ptr;
+// Frees storage of variables held in frame slots [start;end)
+void clear_slots(Variable *frame, size_t start, size_t end){
+    for(size_t i = start; i<end; i++){
+        if(frame[i].modifyer == MOD_ARRAY && frame[i].type != TYPE_STRING){
+            free(frame[i].ptr);
+        }
+        frame[i] = (Variable){0};
+    }
+}
+
+ssize_t evaluate_binop(enum BinopEnum op, ssize_t lhs, ssize_t rhs, Token token){
+    switch(op){
+        case BINOP_ADD:        return lhs + rhs;
+        case BINOP_SUB:        return lhs - rhs;
+        case BINOP_MUL:        return lhs * rhs;
+        case BINOP_DIV:
+        case BINOP_MOD:
+            if(rhs == 0){
+                RUNTIMEERROR(" Error: division by zero");
+            }
+            return (op == BINOP_DIV) ? lhs / rhs : lhs % rhs;
+        case BINOP_LESS:       return lhs <  rhs;
+        case BINOP_LESS_EQ:    return lhs <= rhs;
+        case BINOP_GREATER:    return lhs >  rhs;
+        case BINOP_GREATER_EQ: return lhs >= rhs;
+        case BINOP_EQ:         return lhs == rhs;
+        case BINOP_NOT_EQ:     return lhs != rhs;
+        default:               return 0;
+    }
+}
+
+void push_postfix(Expr *site, RpnObject obj){
+    site->rpn = realloc(site->rpn, sizeof(RpnObject)*(site->rpnc+1));
+    site->rpn[site->rpnc++] = obj;
+}
+
+// Flattens expression tree into postfix, call arguments stay separate sites
+void compile_postfix(Expr *site, Expr *expr){
+    switch(expr->kind){
+        case EXPR_NUMERIC:
+            push_postfix(site, (RpnObject){.type = RPN_NUM, .numeric = expr->num});
             break;
-        case TYPE_I32:
-            value = *(int32_t*)var.ptr;
+        case EXPR_STRING:
+            push_postfix(site, (RpnObject){.type = RPN_STRING, .expr = expr});
             break;
-        case TYPE_I64:
-            value = *(ssize_t*)var.ptr;
+        case EXPR_VAR:
+            push_postfix(site, (RpnObject){.type = RPN_VAR, .expr = expr});
             break;
-        case TYPE_NOT_A_TYPE:
-            printloc(loc);
-            logf(" Error: could not find variable!!!\n");
-            exit(1);
+        case EXPR_INDEX:
+            compile_postfix(site, expr->index);
+            push_postfix(site, (RpnObject){.type = RPN_INDEX, .expr = expr});
             break;
-        default:
-           logf("EROR: i8 i32 i64 types supported for get_num_value\n");
-           exit(1);
-    }
-    return value;
-}
-ssize_t get_arr_num_value(Variable var, size_t index){
-    ssize_t value = 0;
-    switch(var.type){
-        case TYPE_I8:
-            value = *((int8_t*)var.ptr+index);
+        case EXPR_LENGTH:
+            push_postfix(site, (RpnObject){.type = RPN_LENGTH, .expr = expr});
             break;
-        case TYPE_I32:
-            value = *((int32_t*)var.ptr+index);
+        case EXPR_BINARY:
+            compile_postfix(site, expr->binary.lhs);
+            compile_postfix(site, expr->binary.rhs);
+            push_postfix(site, (RpnObject){.type = RPN_OPERATOR, .expr = expr});
             break;
-        case TYPE_I64:
-            value = *((ssize_t*)var.ptr+index);
+        case EXPR_CALL:
+            push_postfix(site, (RpnObject){.type = RPN_CALL, .expr = expr});
+            break;
+        case EXPR_STDCALL:
+            push_postfix(site, (RpnObject){.type = RPN_STDCALL, .expr = expr});
             break;
-        default:
-           logf("EROR: i8 i32 i64 types supported for get_num_value\n");
-           exit(1);
-    }
-    return value;
-}
-Variable get_var_by_name(SView sv, Variables *variables, ssize_t depth){
-    while(depth>-1){
-        for(size_t i = 0; i<variables[depth].varc; i++){
-            if(SVSVCMP(sv, variables[depth].variables[i].name) == 0){
-                return variables[depth].variables[i];
-            }
-        }
-        depth--;
     }
-    return (Variable){.type=TYPE_NOT_A_TYPE};
 }
 
-typedef struct {
-    enum {RPN_OPERATOR, RPN_NUM} type;
-    union {
-        Token oper;
-        ssize_t numeric;
-    };
-} RpnObject;
-
-int OP_PREC[] = {
-    [TOKEN_OP_MUL] = 5,
-    [TOKEN_OP_DIV] = 4,
-    [TOKEN_OP_MOD] = 3,
-    [TOKEN_OP_PLUS] = 2,
-    [TOKEN_OP_MINUS] = 1,
-};
+// Scratch stack shared by nested evaluations, it only grows,
+// so evaluation does not allocate once it is big enough
+_Thread_local CBReturn *rpn_stack = NULL;
+_Thread_local size_t rpn_cap = 0;
+_Thread_local size_t rpn_top = 0;
 
-Variable get_var_from_arr(Variable arr_var, ssize_t arr_index){
-    if(arr_index>(ssize_t)arr_var.size || arr_index<0){
-        //RUNTIMEERROR(" Error: array index is out of range [0;array.size)");
+void rpn_reserve(size_t size){
+    if(size <= rpn_cap){
+        return;
     }
-    void *arr_id_ptr=NULL;
-    switch(arr_var.type){
-        case TYPE_I8:
-            arr_id_ptr = (int8_t*)arr_var.ptr+arr_index;
-            break;
-        case TYPE_I32:
-            arr_id_ptr = (int32_t*)arr_var.ptr+arr_index;
-            break;
-        case TYPE_I64:
-            arr_id_ptr = (ssize_t*)arr_var.ptr+arr_index;
-            break;
-        default:
-            break;
+    rpn_cap = rpn_cap ? rpn_cap : 64;
+    while(rpn_cap < size){
+        rpn_cap *= 2;
     }
-    Variable var = (Variable){.name = arr_var.name, .modifyer = MOD_NO_MOD, .type = arr_var.type, .ptr = arr_id_ptr};
-    return var;
+    rpn_stack = realloc(rpn_stack, sizeof(CBReturn)*rpn_cap);
 }
 
-CBReturn evaluate_expr(Token *expr, ssize_t expr_size, Variables *variables, size_t depth){
-    RpnObject *stack = malloc(sizeof(*stack)*expr_size);
-    RpnObject *postfix = malloc(sizeof(RpnObject)*expr_size);
-    ssize_t value;
-    Variable var;
-    CBReturn rval;
-    rval.type = TYPE_NOT_A_TYPE;
-    int top = -1;
-    int j = 0;
-    for(int i = 0; i<expr_size; i++){
-        switch(expr[i].type){
-            case TOKEN_STR_LITERAL:
-                rval.type = TYPE_STRING;
-                rval.string = expr[i].sv;
-                goto eval_expr_ret;
+CBReturn evaluate_expr(Expr *expr, Variable *frame){
+    stats.expr_evaluations++;
+    if(expr->rpn == NULL){
+        compile_postfix(expr, expr);
+    }
+    size_t base = rpn_top;
+    rpn_reserve(base + expr->rpnc);
+    // rpn_stack is indexed, nested calls may move it
+    for(size_t i = 0; i<expr->rpnc; i++){
+        RpnObject obj = expr->rpn[i];
+        CBReturn rval = {.returned = true, .type = TYPE_NUMERIC};
+        Token token;
+        Variable *var;
+        if(obj.type != RPN_NUM){
+            token = obj.expr->token;
+        }
+        switch(obj.type){
+            case RPN_NUM:
+                rval.num = obj.numeric;
+                break;
+            case RPN_STRING:
+                rval.type   = TYPE_STRING;
+                rval.string = token.sv;
                 break;
-            case TOKEN_OP_DIV:
-            case TOKEN_OP_MUL:
-            case TOKEN_OP_PLUS:
-            case TOKEN_OP_MINUS:
-            case TOKEN_OP_MOD:
-                while (top > -1 && OP_PREC[stack[top].type] >= OP_PREC[expr[i].type]){
-                    postfix[j++] = stack[top--];
+            case RPN_VAR:
+                var = &frame[obj.expr->slot];
+                rval.type = var->type;
+                if(var->type == TYPE_STRING){
+                    rval.string = (SView){.data = var->ptr, .size = var->size};
+                    break;
+                }
+                if(var->modifyer == MOD_ARRAY){
+                    RUNTIMEERROR(" Error: expected .length or [index] after array name");
                 }
-                stack[top+1].type=RPN_OPERATOR;
-                stack[top+1].oper.type = expr[i].type;
-                top++;
+                rval.num = var->num;
                 break;
-            case TOKEN_NUMERIC:
-                value = SVTOL(expr[i].sv);
-                postfix[j].type=RPN_NUM;
-                postfix[j].numeric=value;
-                j++;
+            case RPN_INDEX:{
+                var = &frame[obj.expr->slot];
+                if(var->modifyer != MOD_ARRAY){
+                    TOKENERROR(" Error: trying to use usual variable as array ");
+                }
+                ssize_t arr_index = rpn_stack[--rpn_top].num;
+                if(!obj.expr->in_range){
+                    check_index(*var, arr_index, obj.expr->token.loc);
+                }
+                rval.type = var->type;
+                rval.num  = get_arr_num_value(*var, arr_index);
                 break;
-            case TOKEN_NAME:
-                {
-                    var = get_var_by_name(expr[i].sv, variables, depth);
-                    if(var.type!=TYPE_NOT_A_TYPE){
-                        rval.type = var.type; // TODO: check if type has not been already assigned
-                        if(var.modifyer==MOD_ARRAY){
-                            Token token = expr[++i];
-                            global_location = token.loc;
-                            if(token.type==TOKEN_DOT){
-                                i++;
-                                if(SVCMP(expr[i].sv, "length")==0){
-                                    value = var.size;
-                                } else {
-                                    TOKENERROR(" Error, array has no such field ");
-                                }
-                            } else if(token.type == TOKEN_OSQUAR){
-                                Token *expr_start = &expr[i];
-                                size_t exprc=0;
-                                COLLECT_EXPR(TOKEN_OSQUAR, TOKEN_CSQUAR, expr, i);
-                                size_t arr_index = evaluate_expr(expr_start, exprc, variables, depth).num;
-                                Variable var_ret = get_var_from_arr(var, arr_index);
-                                value = get_num_value(var_ret, token.loc);
-                            } else {
-                                RUNTIMEERROR("Expected .length or [index], got ");
-                            }
-                        } else {
-                            value = get_num_value(var, expr[i].loc);
-                        }
-                        postfix[j].type=RPN_NUM;
-                        postfix[j].numeric=value;
-                        j++;
-                        break;
-                    }
-                // function call handling
-#include "fncall.c"
+            }
+            case RPN_LENGTH:
+                var = &frame[obj.expr->slot];
+                if(var->modifyer != MOD_ARRAY){
+                    TOKENERROR(" Error: only arrays have length, got ");
                 }
-            default:break;
-        }
-    }
-    while (top > -1) {
-        postfix[j++] = stack[top--];
-    }
-    top = 0;
-    for(int i = 0; i<j; i++){
-        stack[top] = postfix[i];
-        if(stack[top].type == RPN_OPERATOR){
-            stack[top-2].type = RPN_NUM;
-            switch(stack[top].oper.type){
-                case TOKEN_OP_PLUS:
-                    stack[top-2].numeric = stack[top-1].numeric + stack[top-2].numeric;
-                    break;
-                case TOKEN_OP_MINUS:
-                    stack[top-2].numeric = stack[top-2].numeric - stack[top-1].numeric;
-                    break;
-                case TOKEN_OP_MUL:
-                    stack[top-2].numeric = stack[top-1].numeric * stack[top-2].numeric;
-                    break;
-                case TOKEN_OP_MOD:
-                    stack[top-2].numeric = stack[top-2].numeric % stack[top-1].numeric;
-                    break;
-                case TOKEN_OP_DIV:
-                    stack[top-2].numeric = stack[top-2].numeric / stack[top-1].numeric;
-                    break;
-                default:break;
+                rval.num = var->size;
+                break;
+            case RPN_OPERATOR:{
+                // the rightmost typed operand decides expression type
+                CBReturn rhs = rpn_stack[--rpn_top];
+                CBReturn lhs = rpn_stack[--rpn_top];
+                enum BinopEnum op = obj.expr->binary.op;
+                if(lhs.type == TYPE_STRING || rhs.type == TYPE_STRING){
+                    RUNTIMEERROR(" Error: arithmetic on strings is not supported");
+                }
+                rval.type = (rhs.type != TYPE_NUMERIC) ? rhs.type : lhs.type;
+                if(op >= BINOP_LESS){
+                    rval.type = TYPE_NUMERIC;
+                }
+                rval.num = evaluate_binop(op, lhs.num, rhs.num, token);
+                break;
             }
-            top = top-2;
+            case RPN_CALL:
+                rval.num = call_function(obj.expr, frame).num;
+                break;
+            case RPN_STDCALL:
+                rval.num = evaluate_stdcall(obj.expr, frame).num;
+                break;
         }
-        top++;
-    }
-    if(rval.type==TYPE_NOT_A_TYPE){
-        rval.type = TYPE_NUMERIC;
+        rpn_stack[rpn_top++] = rval;
     }
-    rval.num = stack[top-1].numeric;
-    rval.returned = true;
-eval_expr_ret:
-    free(stack);
-    free(postfix);
-    return rval;
+    rpn_top = base;
+    return rpn_stack[base];
 }
 
-bool evaluate_bool_expr(Token *expr, ssize_t expr_size, Variables *variables, size_t depth){
-    if(expr_size <= 0){return 0;}
-    ssize_t left_expr_size = 0;
-    while(expr[left_expr_size].type != TOKEN_OP_LESS && expr[left_expr_size].type != TOKEN_OP_GREATER
-            && expr[left_expr_size].type != TOKEN_OP_NOT && expr[left_expr_size].type != TOKEN_OP_NOT
-            && expr[left_expr_size].type != TOKEN_EQUAL_SIGN){
-        left_expr_size++;
-    }
-    enum TokenEnum token_op = expr[left_expr_size].type;
-    Token token_op_next = expr[left_expr_size+1];
-    ssize_t right_expr_size = expr_size-left_expr_size-1;
-    ssize_t left_value = evaluate_expr(expr, left_expr_size, variables, depth).num;
-    ssize_t right_value = evaluate_expr(expr+left_expr_size+1, right_expr_size, variables, depth).num;
-    switch(token_op){
-        case TOKEN_OP_LESS:
-            if(token_op_next.type==TOKEN_EQUAL_SIGN){
-                return left_value<=right_value;
-            }
-            return left_value < right_value;
-        case TOKEN_OP_GREATER:
-            if(token_op_next.type==TOKEN_EQUAL_SIGN){
-                return left_value>=right_value;
-            }
-            return left_value>right_value;
-        case TOKEN_OP_NOT:
-            if(token_op_next.type!=TOKEN_EQUAL_SIGN){
-                printloc(token_op_next.loc);
-                logf(" Error: expected '!=', got !%.*s\n", SVVARG(token_op_next.sv));
-                exit(1);
-            }
-            return left_value != right_value;
-        case TOKEN_EQUAL_SIGN:
-            if(token_op_next.type!=TOKEN_EQUAL_SIGN){
-                printloc(token_op_next.loc);
-                logf(" Error: assignation on condition, expected '==', got =%.*s\n", SVVARG(token_op_next.sv));
-                exit(1);
-            }
-            return left_value == right_value;
-        default:break;
+bool evaluate_bool_expr(Expr *expr, Variable *frame){
+    if(expr->kind == EXPR_NUMERIC){ // folded by optimizer
+        return expr->num != 0;
     }
-    return false;
+    return evaluate_expr(expr, frame).num != 0;
 }
 
-Variable update_var_from_expr(Token *expr, size_t call_exprc, Variables *variables, size_t depth){
-    (void) call_exprc;
-    // creating new variable
-    Token token=expr[0]; // var type
-    Variable var={0};
-    int i=0;
-    bool new_var=false;
-    if(token_variable_type(token) != TYPE_NOT_A_TYPE){ // if type specified
-        var.type = token_variable_type(token);
-        token    = expr[++i]; // var name
-        global_location = token.loc;
-        for(size_t i = 0; i<variables[depth].varc; i++){
-            if(SVSVCMP(token.sv, variables[depth].variables[i].name) == 0){
-                printf("'%.*s' on depth %zu\n", SVVARG(token.sv), depth);
-                RUNTIMEERROR(" Error: variable exists");
+// Turns std argument into variable: names are passed as is and written back
+// after the call, array items are passed as views, so std functions are able
+// to write into them, other expressions are evaluated
+Variable evaluate_std_arg(Expr *arg, Variable *frame){
+    Token token = arg->token;
+    switch(arg->kind){
+        case EXPR_STRING:
+            return (Variable){.type = TYPE_STRING, .modifyer = MOD_ARRAY,
+                              .ptr = token.sv.data, .size = token.sv.size};
+        case EXPR_VAR:
+            return frame[arg->slot];
+        case EXPR_INDEX:{
+            Variable *var = &frame[arg->slot];
+            if(var->modifyer != MOD_ARRAY){
+                TOKENERROR(" Error: trying to use usual variable as array ");
             }
+            ssize_t arr_index = evaluate_expr(arg->index, frame).num;
+            check_index(*var, arr_index, token.loc);
+            return get_var_from_arr(*var, arr_index);
         }
-        var.name = token.sv;
-        if(expr[i+1].type != TOKEN_OSQUAR){
-            if(var.type==TYPE_STRING){
-                var.modifyer = MOD_ARRAY;
-                var.ptr = malloc(token.sv.size+1); //TODO: RAM leak?
-            } else {
-                var.modifyer = MOD_NO_MOD;
-                var.ptr = malloc(get_type_size_in_bytes(var.type));
-            }
-        } else { // variable is array
-            token = expr[i++]; // still var name (?)
-            var.modifyer = MOD_ARRAY;
-            Token *expr_start = &expr[++i]; // index expr start
-            global_location = token.loc;
-            size_t exprc=0;
-            COLLECT_EXPR(TOKEN_OSQUAR, TOKEN_CSQUAR, expr, i);
-            size_t arrlen = evaluate_expr(expr_start, exprc, variables, depth).num;
-            var.ptr = malloc(get_type_size_in_bytes(var.type)*arrlen);
-            memset(var.ptr, 0, get_type_size_in_bytes(var.type)*arrlen);
-            var.size = arrlen;
+        default:
+            return (Variable){.type = TYPE_I64, .modifyer = MOD_NO_MOD,
+                              .num = evaluate_expr(arg, frame).num};
+    }
+}
+
+CBReturn evaluate_stdcall(Expr *call, Variable *frame){
+    Variable args[STD_MAX_ARGS];
+    for(size_t i = 0; i<call->call.argc; i++){
+        args[i] = evaluate_std_arg(call->call.args[i], frame);
+    }
+    global_location = call->token.loc;
+    stats.std_calls++;
+    CBReturn ret = call->call.std(args, call->call.argc);
+    for(size_t i = 0; i<call->call.argc; i++){
+        Expr *arg = call->call.args[i];
+        if(arg->kind == EXPR_VAR && args[i].modifyer == MOD_NO_MOD){
+            frame[arg->slot].num = args[i].num;
         }
-        new_var = true;
-        if(variables[depth].varc == 0){
-            variables[depth].variables = malloc(sizeof(Variable)*2); // TODO: fox
-        } else {
-            variables[depth].variables =
-                realloc(variables[depth].variables, sizeof(Variable)*(variables[depth].varc+2));
+    }
+    return ret;
+}
+
+void evaluate_declaration(Stmt *stmt, Variable *frame){
+    Token token = stmt->token;
+    Var_signature sig = stmt->decl.sig;
+    Variable var = {.name = sig.name, .type = sig.type, .modifyer = sig.modifyer};
+    if(stmt->decl.size != NULL){ // variable is array
+        ssize_t arrlen = evaluate_expr(stmt->decl.size, frame).num;
+        if(arrlen < 0){
+            RUNTIMEERROR(" Error: negative array size");
         }
-        if(var.modifyer == MOD_ARRAY && var.type!=TYPE_STRING){
-            size_t varc = variables[depth].varc;
-            variables[depth].variables[varc] = var;
-            variables[depth].varc++;
-        } // array initialisation not supported for now
-    } else { // if var exists -> just load it
-        var = get_var_by_name(token.sv, variables, depth);
+        var.ptr  = calloc(arrlen ? arrlen : 1, get_type_size_in_bytes(var.type));
+        var.size = arrlen;
+        frame[stmt->decl.slot] = var;
+        return;
+    }
+    CBReturn val = {.type = TYPE_NUMERIC, .num = 0};
+    if(stmt->decl.value != NULL){
+        val = evaluate_expr(stmt->decl.value, frame);
+    } else if(var.type == TYPE_STRING){
+        val = (CBReturn){.type = TYPE_STRING};
     }
-    if(expr[i+1].type == TOKEN_OSQUAR && !new_var){ // if square bracket after variable name, then it is acces to array.
-        if(var.modifyer!=MOD_ARRAY){
+    global_location = token.loc;
+    var_cast(&var, val);
+    frame[stmt->decl.slot] = var;
+}
+
+void evaluate_assignment(Stmt *stmt, Variable *frame){
+    Expr *target = stmt->assign.target;
+    Token token  = target->token;
+    if(target->kind == EXPR_VAR && target->decl->modifyer == MOD_ARRAY && target->decl->type != TYPE_STRING){
+        assign_array(frame[target->slot], frame[stmt->assign.value->slot], token.loc);
+        return;
+    }
+    CBReturn val = evaluate_expr(stmt->assign.value, frame);
+    Variable *var = &frame[target->slot];
+    Variable dst = *var;
+    if(target->kind == EXPR_INDEX){ // if square bracket after variable name, then it is acces to array.
+        if(var->modifyer!=MOD_ARRAY){
             TOKENERROR(" Error: trying to use usual variable as array, expected '[', got ");
         }
-        token = expr[++i];
-        global_location = token.loc;
-        Token *expr_start = &expr[++i];
-        global_location = token.loc;
-        size_t exprc=0;
-        COLLECT_EXPR(TOKEN_OSQUAR, TOKEN_CSQUAR, expr, i);
-        ssize_t arr_index = evaluate_expr(expr_start, exprc, variables, depth).num;
-        void *arr_id_ptr = NULL;
-        if(arr_index>=(ssize_t)var.size || arr_index<0){
-            printloc(token.loc);
-            logf(" Error: array index %zd is out of range [0;%zd)\n", arr_index, var.size);
-            exit(69);
+        ssize_t arr_index = evaluate_expr(target->index, frame).num;
+        if(!target->in_range){
+            check_index(*var, arr_index, token.loc);
         }
-        switch(var.type){
-            case TYPE_I8:
-                arr_id_ptr = (int8_t*)var.ptr+arr_index;
-                break;
-            case TYPE_I32:
-                arr_id_ptr = (int32_t*)var.ptr+arr_index;
-                break;
-            case TYPE_I64:
-                arr_id_ptr = (ssize_t*)var.ptr+arr_index;
-                break;
-            default:
-                break;
-        }
-        var = (Variable){.name = var.name, .modifyer = MOD_NO_MOD, .type = var.type, .ptr = arr_id_ptr};
+        dst = get_var_from_arr(*var, arr_index);
     }
-    Token op_token = expr[++i];
     global_location = token.loc;
-    // assignation
-    switch(op_token.type){
-        case TOKEN_EQUAL_SIGN:{
-            token = expr[++i];
-            global_location = token.loc;
-            int expr_size = 0;
-            Token *expr_start = &expr[i];
-            while(token.type != TOKEN_SEMICOLON){
-                token = expr[++i];
-                global_location = token.loc;
-                expr_size++;
+    if(stmt->assign.op != BINOP_NONE){
+        val.num  = evaluate_binop(stmt->assign.op, get_num_value(dst, token.loc), val.num, token);
+        val.type = TYPE_NUMERIC;
+    }
+    var_cast(&dst, val);
+    if(target->kind == EXPR_VAR){
+        *var = dst;
+    }
+}
+
+CBReturn evaluate_code_block(Block block, Variable *frame);
+
+// Evaluates block in its own scope, its variables are freed on exit
+CBReturn evaluate_scope(Block block, Variable *frame){
+    CBReturn ret = evaluate_code_block(block, frame);
+    clear_slots(frame, block.slot_start, block.slot_end);
+    return ret;
+}
+
+// Statement kind is decoded once by parser. With computed goto every
+// handler jumps straight into the next statement handler, otherwise
+// statements go through portable switch.
+#if defined(__GNUC__) && !defined(NO_THREADED_DISPATCH)
+#define THREADED_DISPATCH
+#endif
+
+// Loop conditions run after the body, their time goes to the loop line
+#define PROFILE_STATEMENT() \
+    if(trace_statements){ \
+        profile_statement(stmt->token.loc.row); \
+    }
+#define PROFILE_LOOP() \
+    if(trace_statements){ \
+        profile_switch(stmt->token.loc.row); \
+    }
+
+#ifdef THREADED_DISPATCH
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpedantic"
+#define STMT_CASE(kind) stmt_##kind
+#define STMT_DISPATCH() \
+    if(stmt == end){ \
+        return (CBReturn){0}; \
+    } \
+    global_location = stmt->token.loc; \
+    PROFILE_STATEMENT(); \
+    goto *STMT_LABELS[stmt->kind]
+#define STMT_NEXT() stmt++; STMT_DISPATCH()
+#else
+#define STMT_CASE(kind) case kind
+#define STMT_NEXT() continue
+#endif
+
+CBReturn evaluate_code_block(Block block, Variable *frame){
+    CBReturn ret = {0};
+    Stmt *stmt = block.stmts;
+    Stmt *end  = block.stmts + block.stmtc;
+#ifdef THREADED_DISPATCH
+    static void *const STMT_LABELS[] = {
+        [STMT_DECL    ] = &&STMT_CASE(STMT_DECL),
+        [STMT_ASSIGN  ] = &&STMT_CASE(STMT_ASSIGN),
+        [STMT_EXPR    ] = &&STMT_CASE(STMT_EXPR),
+        [STMT_IF      ] = &&STMT_CASE(STMT_IF),
+        [STMT_WHILE   ] = &&STMT_CASE(STMT_WHILE),
+        [STMT_FOR     ] = &&STMT_CASE(STMT_FOR),
+        [STMT_RETURN  ] = &&STMT_CASE(STMT_RETURN),
+        [STMT_BREAK   ] = &&STMT_CASE(STMT_BREAK),
+        [STMT_CONTINUE] = &&STMT_CASE(STMT_CONTINUE),
+    };
+    STMT_DISPATCH();
+#else
+    for(; stmt<end; stmt++){
+    global_location = stmt->token.loc;
+    PROFILE_STATEMENT();
+    switch(stmt->kind){
+#endif
+    STMT_CASE(STMT_DECL):
+        evaluate_declaration(stmt, frame);
+        STMT_NEXT();
+    STMT_CASE(STMT_ASSIGN):
+        evaluate_assignment(stmt, frame);
+        STMT_NEXT();
+    STMT_CASE(STMT_EXPR):
+        evaluate_expr(stmt->expr, frame);
+        STMT_NEXT();
+    STMT_CASE(STMT_IF):
+        if(evaluate_bool_expr(stmt->if_stmt.cond, frame)){
+            ret = evaluate_scope(stmt->if_stmt.then_block, frame);
+        } else {
+            ret = evaluate_scope(stmt->if_stmt.else_block, frame);
+        }
+        if(ret.returned || ret.flow != FLOW_NEXT){
+            return ret;
+        }
+        STMT_NEXT();
+    STMT_CASE(STMT_WHILE):
+        while(evaluate_bool_expr(stmt->while_stmt.cond, frame)){
+            ret = evaluate_scope(stmt->while_stmt.body, frame);
+            if(ret.returned){
+                return ret;
             }
-            CBReturn val = evaluate_expr(expr_start, expr_size, variables, depth);
-            var_cast(&var, val);
-            size_t varc = variables[depth].varc;
-            if(new_var){
-                variables[depth].variables[varc] = var;
-                variables[depth].varc++;
+            if(ret.flow == FLOW_BREAK){
+                break;
             }
-            break;
+            PROFILE_LOOP();
         }
-        case TOKEN_SEMICOLON:{
-            var_cast(&var, (CBReturn){.type=TYPE_NUMERIC, .num=0});
-            size_t varc = variables[depth].varc;
-            variables[depth].variables[varc] = var;
-            if(new_var){
-                variables[depth].varc++;
+        STMT_NEXT();
+    STMT_CASE(STMT_FOR):
+        ret = (CBReturn){0};
+        evaluate_declaration(stmt->for_stmt.init, frame);
+        while(evaluate_bool_expr(stmt->for_stmt.cond, frame)){
+            ret = evaluate_scope(stmt->for_stmt.body, frame);
+            if(ret.returned || ret.flow == FLOW_BREAK){
+                break;
             }
-            break;
+            PROFILE_LOOP();
+            evaluate_assignment(stmt->for_stmt.update, frame);
         }
-        default:{
-                token = expr[++i];
-                if(token.type!=TOKEN_EQUAL_SIGN){
-                    TOKENERROR(" Error: expected '=', got ");
-                }
-                int expr_size = 0;
-                Token *expr_start = &expr[i];
-                while(token.type != TOKEN_SEMICOLON){
-                    token = expr[++i];
-                    global_location = token.loc;
-                    expr_size++;
-                }
-                ssize_t val = evaluate_expr(expr_start, expr_size, variables, depth).num;
-                CBReturn tmpret;
-                tmpret.type = TYPE_NUMERIC;
-                switch(op_token.type){
-                case TOKEN_OP_PLUS:
-                    tmpret.num = get_num_value(var, token.loc)+val;
-                    var_cast(&var, tmpret);
-                    break;
-                case TOKEN_OP_MINUS:
-                    tmpret.num = get_num_value(var, token.loc)-val;
-                    var_cast(&var, tmpret);
-                    break;
-                case TOKEN_OP_MUL:
-                    tmpret.num = get_num_value(var, token.loc)*val;
-                    var_cast(&var, tmpret);
-                    break;
-                case TOKEN_OP_DIV:
-                    tmpret.num = get_num_value(var, token.loc)/val;
-                    var_cast(&var, tmpret);
-                    break;
-                default:
-                    TOKENERROR(" Error: expected '=' or ';', got ");
-                }
-                size_t varc = variables[depth].varc;
-                if(new_var){
-                    variables[depth].variables[varc] = var;
-                    variables[depth].varc++;
-                }
+        clear_slots(frame, stmt->for_stmt.init->decl.slot, stmt->for_stmt.init->decl.slot+1);
+        if(ret.returned){
+            return ret;
+        }
+        STMT_NEXT();
+    STMT_CASE(STMT_RETURN):
+        if(stmt->expr != NULL && stmt->expr->kind == EXPR_CALL && stmt->expr->call.tail){
+            return tail_call(stmt->expr, frame);
         }
+        ret = (CBReturn){.returned = true};
+        if(stmt->expr != NULL){
+            CBReturn ret_val = evaluate_expr(stmt->expr, frame);
+            if(ret_val.type==TYPE_STRING){
+                ret.string = ret_val.string;
+            } else {
+                ret.num = ret_val.num;
+            }
+            ret.type = ret_val.type;
+        }
+        return ret;
+    STMT_CASE(STMT_BREAK):
+        return (CBReturn){.flow = FLOW_BREAK};
+    STMT_CASE(STMT_CONTINUE):
+        return (CBReturn){.flow = FLOW_CONTINUE};
+#ifndef THREADED_DISPATCH
+    }
     }
-    return var;
+#endif
+    return (CBReturn){0};
 }
 
-bool function_return = false;
-CBReturn evaluate_code_block(CodeBlock block){
-    CBReturn ret = {0};
-    for(size_t i = 0; i<block.exprc; i++){
-        Token token = block.code[i];
-        switch(token.type){
-            case TOKEN_NAME:{
-                if(token_variable_type(token) != TYPE_NOT_A_TYPE
-                    || get_var_by_name(token.sv, block.variables, block.depth).ptr != NULL){
-                    Token *expr_start = &block.code[i];
-                    size_t exprc=0;
-                    while(token.type!=TOKEN_SEMICOLON){
-                        token = block.code[++i];
-                        exprc++;
-                    }
+#ifdef THREADED_DISPATCH
+#pragma GCC diagnostic pop
+#endif
+#undef STMT_CASE
+#undef STMT_NEXT
+#undef STMT_DISPATCH
+#undef PROFILE_STATEMENT
+#undef PROFILE_LOOP
 
-                    Variable var = update_var_from_expr(expr_start, exprc, block.variables, block.depth); // TODO: check if works
-                    (void)var;
-                } else { // should be function call
-                    bool is_stdcall=false;
-                    if(SVCMP(block.code[i].sv, "std")==0){
-                        if(block.code[i+1].type!=TOKEN_DOT){
-                            token = block.code[i+1];
-                            TOKENERROR("expected '.' after 'std' in stdcall");
-                        }
-                        i+=2;
-                        is_stdcall = true;
-                    }
-                    Token *expr_start = &block.code[i];
-                    size_t exprc = 0;
-                    while(token.type != TOKEN_SEMICOLON){
-                        token = block.code[++i];
-                        global_location = token.loc;
-                        exprc++;
-                    }
-                    if(is_stdcall){
-                        stdcall(expr_start, exprc, block.variables, block.depth);
-                    } else {
-                        evaluate_expr(expr_start, exprc, block.variables, block.depth);
-                    }
-                }
-            }break;
-            case TOKEN_IF:{
-                token = block.code[++i];
-                global_location = token.loc;
-                if(token.type != TOKEN_OPAREN){
-                    TOKENERROR(" Error, expected '(', got ");
-                }
-                token = block.code[++i];
-                global_location = token.loc;
-                Token *expr_start = &block.code[i];
-                int exprc = 0;
-                while(token.type != TOKEN_CPAREN){
-                    token = block.code[++i];
-                    global_location = token.loc;
-                    exprc++;
-                }
-                bool if_true = evaluate_bool_expr(expr_start, exprc, block.variables, block.depth);
-                if(!if_true){ // skip if block
-                   for(int depth_level = 0; token.type != TOKEN_CCURLY || depth_level>0;){
-                        token = block.code[++i];
-                        global_location = token.loc;
-                        switch(token.type){
-                            case TOKEN_OCURLY:depth_level++;break;
-                            case TOKEN_CCURLY:depth_level--;break;
-                            default:break;
-                        }
-                    }
-                }
-                // if block, else, just code
-                if(if_true || block.code[i+1].type == TOKEN_ELSE){
-                    while(token.type != TOKEN_OCURLY){
-                        token = block.code[++i];
-                        global_location = token.loc;
-                    }
-                    token = block.code[++i];
-                    global_location = token.loc;
-                    Token *expr_start = &block.code[i];
-                    int exprc = 0;
-                    for(int depth_level = 1; token.type != TOKEN_CCURLY || depth_level>0;){
-                        token = block.code[++i];
-                        global_location = token.loc;
-                        exprc++;
-                        switch(token.type){
-                            case TOKEN_OCURLY:depth_level++;break;
-                            case TOKEN_CCURLY:depth_level--;break;
-                            default:break;
-                        }
-                    }
-                    // HERE 1
-                    ret = evaluate_code_block(
-                            (CodeBlock){
-                                .code = expr_start,
-                                .exprc = exprc,
-                                .variables = block.variables,
-                                .depth = block.depth+1}
-                                );
-                    if(block.code[i+1].type == TOKEN_ELSE){ // skip else block
-                        while(block.code[i+1].type != TOKEN_CCURLY){
-                            token = block.code[++i];
-                            global_location = token.loc;
-                        }
-                    }
-                    if(ret.returned){
-                        goto eval_ret;
-                    }
-                }
-            }break;
-            case TOKEN_FOR:{
-                token = block.code[++i];
-                global_location = token.loc;
-                if(token.type != TOKEN_OPAREN){
-                    TOKENERROR(" Error, expected '(', got ");
-                }
-                token = block.code[++i];
-                global_location = token.loc;
-                if(token_variable_type(token)==TYPE_NOT_A_TYPE){ // creating type
-                    RUNTIMEERROR(" Error: for loops must initialize variable");
-                }
-                Token *expr_start = &block.code[i];
-                size_t exprc=0;
-                while(token.type!=TOKEN_SEMICOLON){
-                    token = block.code[++i];
-                    global_location = token.loc;
-                    exprc++;
-                }
-                token = block.code[++i]; // consume semicolon
-                exprc++;
-                Variable iterator_variable = update_var_from_expr(expr_start, exprc, block.variables, block.depth+1); // TODO: check if work;
-                (void) iterator_variable;
-                // EDIT FROM HERE
-                Token *for_expr_start = &block.code[i];
-                int for_expr_exprc = 0;
-                while(token.type != TOKEN_SEMICOLON){
-                    token = block.code[++i];
-                    global_location = token.loc;
-                    for_expr_exprc++;
-                }
-                i++; //consume semicolon
-                Token *for_upd_expr_start = &block.code[i];
-                int for_upd_expr_exprc = 0;
-                while(token.type != TOKEN_CPAREN){
-                    token = block.code[++i];
-                    global_location = token.loc;
-                    for_upd_expr_exprc++;
-                }
-                token = block.code[++i];
-                global_location = token.loc;
-                Token *for_block_start = &block.code[++i];
-                global_location = token.loc;
-                bool if_true = evaluate_bool_expr(for_expr_start, for_expr_exprc, block.variables, block.depth+1);
-                if(!if_true){ // skip while block
-                    while(token.type != TOKEN_CCURLY){
-                        token = block.code[++i];
-                        global_location = token.loc;
-                    }
-                }
-                if(if_true){
-                    int exprc = 0;
-                    for(int depth_level = 1; token.type != TOKEN_CCURLY || depth_level>0;){
-                        token = block.code[++i];
-                        global_location = token.loc;
-                        exprc++;
-                        switch(token.type){
-                            case TOKEN_OCURLY:depth_level++;break;
-                            case TOKEN_CCURLY:depth_level--;break;
-                            default:break;
-                        }
-                    }
-                    while(evaluate_bool_expr(for_expr_start, for_expr_exprc, block.variables, block.depth+1)){
-                        ret = evaluate_code_block(
-                                (CodeBlock){
-                                    .code = for_block_start,
-                                    .exprc = exprc,
-                                    .variables = block.variables,
-                                    .depth = block.depth+2,
-                                    });
-                        evaluate_code_block(
-                                (CodeBlock){
-                                    .code=for_upd_expr_start,
-                                    .exprc=for_upd_expr_exprc,
-                                    .variables=block.variables,
-                                    .depth=block.depth+1});
-                        block.variables[block.depth+2].varc=0;
-                        if(ret.returned){
-                            goto eval_ret;
-                        }
-                    }
-                    block.variables[block.depth+1].varc=0;
-                }
-            }break;
-            case TOKEN_CONTINUE:{
-                                    goto eval_ret;
-            }break;
-            case TOKEN_WHILE:{
-                token = block.code[++i];
-                global_location = token.loc;
-                if(token.type != TOKEN_OPAREN){
-                    TOKENERROR(" Error, expected '(', got ");
-                }
-                token = block.code[++i];
-                global_location = token.loc;
-                Token *while_expr_start = &block.code[i];
-                int while_expr_exprc = 0;
-                //COUNT_TOKEN_EXPRC(while_expr_exprc)
-                for(int depth_level=1; token.type != TOKEN_CPAREN||depth_level>0; ){
-                    token = block.code[++i];
-                    global_location = token.loc;
-                    while_expr_exprc++;
-                    switch(token.type){
-                        case TOKEN_OPAREN:depth_level++;break;
-                        case TOKEN_CPAREN:depth_level--;break;
-                        default:break;
-                    }
-                }
-                token = block.code[++i];
-                global_location = token.loc;
-                Token *while_block_start = &block.code[++i];
-                global_location = token.loc;
-                bool if_true = evaluate_bool_expr(while_expr_start, while_expr_exprc, block.variables, block.depth);
-                if(!if_true){ // skip while block
-                    while(token.type != TOKEN_CCURLY){
-                        token = block.code[++i];
-                        global_location = token.loc;
-                    }
-                }
-                if(if_true){
-                    int exprc = 0;
-                    for(int depth_level = 1; token.type != TOKEN_CCURLY || depth_level>0;){
-                        token = block.code[++i];
-                        global_location = token.loc;
-                        exprc++;
-                        switch(token.type){
-                            case TOKEN_OCURLY:depth_level++;break;
-                            case TOKEN_CCURLY:depth_level--;break;
-                            default:break;
-                        }
-                    }
-                    while(evaluate_bool_expr(while_expr_start, while_expr_exprc, block.variables, block.depth)){
-                        ret = evaluate_code_block(
-                                (CodeBlock){
-                                    .code = while_block_start,
-                                    .exprc = exprc,
-                                    .variables = block.variables,
-                                    .depth = block.depth+1,
-                                    });
-                        block.variables[block.depth+1].varc=0;
-                        if(ret.returned){
-                            goto eval_ret;
-                        }
-                    }
-                }
-            }break;
-            case TOKEN_RETURN:
-                function_return=true;
-                token = block.code[++i];
-                global_location = token.loc;
-                Token *expr_start = &block.code[i];
-                size_t exprc = 0;
-                while(token.type != TOKEN_SEMICOLON){
-                    token = block.code[++i];
-                    global_location = token.loc;
-                    exprc++;
-                }
-                CBReturn ret_val = evaluate_expr(expr_start, exprc, block.variables, block.depth);
-                if(ret_val.type==TYPE_STRING){
-                    ret.string = ret_val.string;
-                } else {
-                    ret.num = ret_val.num;
-                }
-                ret.type = ret_val.type;
-                ret.returned = true;
-                while(block.variables[block.depth].varc--){
-                    free(block.variables[block.depth].variables[block.variables[block.depth].varc].ptr);
-                }
-                free(block.variables[block.depth].variables);
-                goto eval_ret;
-                break;
-            case TOKEN_CCURLY:
-                break;
-            default:
-                TOKENERROR(" Error: unexpected token ");
-        }
-    }
-    // GC
-eval_ret:
-    return ret;
-}
+#include "fncall.c"
+#include "compiler.c"
+#include "vm.c"
+#include "jit.c"
+#include "stats.c"
+#include "emitc.c"
 
 // interpreter argument shifter functions
 char *args_shift(int *argc, char ***argv){
@@ -1019,6 +657,62 @@ char *args_shift(int *argc, char ***argv){
     return *((*argv)++);
 }
 
+// Maps source file read-only, pages are read only when lexer touches them.
+// Mapping is followed by zeroed bytes, so lexer always finds terminating '\0'
+char *load_source(char *file_name, size_t *size){
+#ifdef _WIN32
+    FILE *file = fopen(file_name, "rb");
+    if(file == NULL){
+        return NULL;
+    }
+    fseek(file, 0, SEEK_END);
+    *size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    char *src = calloc(*size+1, 1);
+    if(fread(src, 1, *size, file) != *size){
+        free(src);
+        src = NULL;
+    }
+    fclose(file);
+    return src;
+#else
+    int fd = open(file_name, O_RDONLY);
+    if(fd < 0){
+        return NULL;
+    }
+    struct stat st;
+    if(fstat(fd, &st) < 0 || !S_ISREG(st.st_mode)){
+        close(fd);
+        return NULL;
+    }
+    *size = st.st_size;
+    size_t page = sysconf(_SC_PAGESIZE);
+    size_t reserved = ((*size+1)/page + 1)*page;
+    char *src = mmap(NULL, reserved, PROT_READ, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+    if(src == MAP_FAILED){
+        close(fd);
+        return NULL;
+    }
+    if(*size > 0 && mmap(src, *size, PROT_READ, MAP_PRIVATE|MAP_FIXED, fd, 0) == MAP_FAILED){
+        munmap(src, reserved);
+        close(fd);
+        return NULL;
+    }
+    close(fd);
+    return src;
+#endif
+}
+
+void unload_source(char *src, size_t size){
+#ifdef _WIN32
+    (void) size;
+    free(src);
+#else
+    size_t page = sysconf(_SC_PAGESIZE);
+    munmap(src, ((size+1)/page + 1)*page);
+#endif
+}
+
 int main(int argc, char **argv){
     // prepare interpreter
     char *program_name = args_shift(&argc, &argv);
@@ -1026,66 +720,144 @@ int main(int argc, char **argv){
         usage(program_name);
         return 0;
     }
+    // allocations are counted from the first one or not at all
+    for(int i = 0; i<argc && strncmp(argv[i], "--", 2) == 0; i++){
+        if(strcmp(argv[i], "--stats") == 0){
+            setup_stats();
+        }
+    }
     char *next_arg = args_shift(&argc, &argv);
-    if(strcmp(next_arg, "--verbose") == 0){
-        verbose = true;
+    while(strncmp(next_arg, "--", 2) == 0){
+        if(strcmp(next_arg, "--verbose") == 0){
+            verbose = true;
+        } else if(strcmp(next_arg, "--tree-walk") == 0){
+            tree_walk = true;
+        } else if(strcmp(next_arg, "--dump-optimized") == 0){
+            dump_optimized = true;
+        } else if(strcmp(next_arg, "--unbuffered") == 0){
+            unbuffered = true;
+        } else if(strcmp(next_arg, "--profile") == 0){
+            profiling = true;
+        } else if(strcmp(next_arg, "--no-jit") == 0){
+            jit_enabled = false;
+        } else if(strcmp(next_arg, "--emit-c") == 0){
+            emit_c = true;
+        } else if(strcmp(next_arg, "--stats") == 0){
+            // set up before parsing flags
+        } else if(strncmp(next_arg, "--sample-profile=", 17) == 0){
+            char *end;
+            long hz = strtol(next_arg+17, &end, 10);
+            if(end == next_arg+17 || *end != '\0' || hz < 1 || hz > 10000){
+                logf("Error: sampling rate has to be 1 to 10000 per second, got '%s'\n", next_arg+17);
+                usage(program_name);
+                return 1;
+            }
+            setup_sampler(hz);
+        } else if(strncmp(next_arg, "--simd=", 7) == 0){
+            for(simd_max = SIMD_SCALAR; simd_max <= SIMD_AVX2; simd_max++){
+                if(strcmp(next_arg+7, SIMD_TO_STR[simd_max]) == 0){
+                    break;
+                }
+            }
+            if(simd_max > SIMD_AVX2){
+                logf("Error: unknown instruction set '%s'\n", next_arg+7);
+                usage(program_name);
+                return 1;
+            }
+        } else {
+            logf("Error: unknown flag '%s'\n", next_arg);
+            usage(program_name);
+            return 1;
+        }
+        if(argc == 0){
+            usage(program_name);
+            return 1;
+        }
         next_arg = args_shift(&argc, &argv);
     }
+    trace_statements = profiling || print_stats;
+    tracing = trace_statements || sampling;
+    jit_enabled = jit_enabled && !trace_statements && !emit_c; // machine code reports calls only
     // Load program code
     char *code_file_name = next_arg;
-    FILE *code_file      = fopen(code_file_name, "r");
-    if(code_file == NULL){
+    size_t code_file_size = 0;
+    char *code_src = load_source(code_file_name, &code_file_size);
+    if(code_src == NULL){
         logf("Error reading provided file. freezing out.\n");
         return 1;
     }
-    fseek(code_file, 0, SEEK_END);
-    int32_t code_file_size = ftell(code_file);
-    fseek(code_file, 0, SEEK_SET);
-    char *code_src = malloc((code_file_size+1)*sizeof(*code_src));
-    fread(code_src, code_file_size, 1, code_file);
-    fclose(code_file);
     // Setup lexer
     Lexer lexer = { .file_name = code_file_name,
                     .line = 1, .bol = 0, .pos = 0,
                     .source = code_src};
     // Parse Functions into memory
-    Func fn;
-    while(lexer.source[lexer.pos+1] != 0){
-        Token token = lexer_next_token(&lexer);
+    for(Token token = lexer_next_token(&lexer); token.type != TOKEN_EOF; token = lexer_next_token(&lexer)){
         switch(token.type){
             case TOKEN_FN_DECL:
-                fn = parse_function(&lexer);
-                fn.body.variables = malloc(sizeof(Variables)*10);
-                for(int i = 0; i<10; i++){
-                    fn.body.variables[i].varc = 0;
-                }
-                fn.body.depth = 1;
-                functions[hash(fn.name)%1024] = fn;
+                add_function(parse_function(&lexer), token.loc);
                 break;
             default:
                 printloc(token.loc);
                 logf(" Error: unimplemented token '%.*s' in global scope\n", SVVARG(token.sv));
         }
     }
+    // Bind names once every function is known
+    for(size_t i=0; i<functions.funcc; i++){
+        resolve_function(&functions.funcs[i]);
+    }
+    for(size_t i=0; i<functions.funcc; i++){
+        if(optimize_function(&functions.funcs[i])){
+            resolve_function(&functions.funcs[i]);
+        }
+        eliminate_bounds_checks(&functions.funcs[i]);
+    }
     // Interpritation
-    fn = functions[hash((SView){"main", 4})%1024];
-    if(fn.ret_type==TYPE_NOT_A_TYPE){
+    Func *fn = find_function((SView){"main", 4});
+    if(fn == NULL || fn->ret_type==TYPE_NOT_A_TYPE){
         logf("Error: could not find entry point 'fn main'\n");
         exit(69);
     }
-    fn.body.depth = 1;
-    setup_cbrstd();
-    for (size_t i = 0; i < fn.body.exprc; i++) {
+    if(emit_c){
+        for(size_t i=0; i<functions.funcc; i++){
+            compile_function(&functions.funcs[i]);
+        }
+        emit_c_program(code_file_name, fn);
+        return 0;
     }
-    evaluate_code_block(fn.body);
-    // FREE !!!
-    for(int i=0; i<1024; i++){
-        if(functions[i].body.code!=NULL){
-            free(functions[i].args);
-            free(functions[i].body.code);
-            free(functions[i].body.variables);
+    setup_cbrstd();
+    setup_simd(simd_max);
+    if(profiling){
+        setup_profile(code_src, code_file_name);
+    }
+    if(tree_walk){
+        run_tree_walk(fn);
+        free_frame_stack();
+        free(tail_args.args);
+    } else {
+        for(size_t i=0; i<functions.funcc; i++){
+            compile_function(&functions.funcs[i]);
+        }
+        if(tracing){
+            profile_enter(fn, 0);
         }
+        setup_stack_limit(&fn, main_stack_size());
+        vm_execute(fn, fn->bytecode.code, 0);
+        free(vm.stack);
+        free(vm.frames);
     }
-    free(code_src);
+    profile_report();
+    sample_report();
+    // FREE !!!
+    for(size_t i=0; i<functions.funcc; i++){
+        free(functions.funcs[i].args);
+        free(functions.funcs[i].body.code);
+        free(functions.funcs[i].body.pairs);
+        free(functions.funcs[i].bytecode.code);
+        free(functions.funcs[i].bytecode.tokens);
+        jit_free(&functions.funcs[i]);
+    }
+    free(functions.funcs);
+    free(functions.index);
+    unload_source(code_src, code_file_size);
     return 0;
 }
@@ -0,0 +1,464 @@
+#include "types.h"
+#include "functions.h"
+
+// Load time optimizations over resolved function trees: folds constant
+// subexpressions, range checks folded values against their target type,
+// drops branches and loops whose condition is known to be false.
+
+bool dump_optimized = false;
+
+void optimizer_report(Token token, char *what){
+    if(dump_optimized){
+        printloc(token.loc);
+        logf(" %s\n", what);
+    }
+}
+
+// Operands are wrapped as unsigned, so folding never hits signed overflow
+bool fold_binop(enum BinopEnum op, ssize_t lhs, ssize_t rhs, ssize_t *result){
+    switch(op){
+        case BINOP_ADD: *result = (size_t)lhs + (size_t)rhs; return true;
+        case BINOP_SUB: *result = (size_t)lhs - (size_t)rhs; return true;
+        case BINOP_MUL: *result = (size_t)lhs * (size_t)rhs; return true;
+        case BINOP_DIV:
+        case BINOP_MOD:
+            if(rhs == 0 || (lhs == INT64_MIN && rhs == -1)){
+                return false; // left for runtime error
+            }
+            *result = (op == BINOP_DIV) ? lhs / rhs : lhs % rhs;
+            return true;
+        case BINOP_LESS:       *result = lhs <  rhs; return true;
+        case BINOP_LESS_EQ:    *result = lhs <= rhs; return true;
+        case BINOP_GREATER:    *result = lhs >  rhs; return true;
+        case BINOP_GREATER_EQ: *result = lhs >= rhs; return true;
+        case BINOP_EQ:         *result = lhs == rhs; return true;
+        case BINOP_NOT_EQ:     *result = lhs != rhs; return true;
+        default:               return false;
+    }
+}
+
+void fold_expr(Expr *expr){
+    switch(expr->kind){
+        case EXPR_INDEX:
+            fold_expr(expr->index);
+            break;
+        case EXPR_CALL:
+        case EXPR_STDCALL:
+            for(size_t i = 0; i<expr->call.argc; i++){
+                fold_expr(expr->call.args[i]);
+            }
+            break;
+        case EXPR_BINARY:{
+            Expr *lhs = expr->binary.lhs;
+            Expr *rhs = expr->binary.rhs;
+            fold_expr(lhs);
+            fold_expr(rhs);
+            enum BinopEnum op = expr->binary.op;
+            ssize_t result;
+            if(lhs->kind != EXPR_NUMERIC || rhs->kind != EXPR_NUMERIC
+                    || !fold_binop(op, lhs->num, rhs->num, &result)){
+                break;
+            }
+            free(lhs);
+            free(rhs);
+            expr->kind = EXPR_NUMERIC;
+            expr->num  = result;
+            if(dump_optimized){
+                printloc(expr->token.loc);
+                logf(" folded '%s' to %zd\n", BINOP_TO_STR[op], result);
+            }
+            break;
+        }
+        default:
+            break;
+    }
+}
+
+// Folded value assigned to scalar fails the same way var_cast would, only earlier
+void check_folded(Expr *value, enum TypeEnum type, SView name){
+    if(value->kind != EXPR_NUMERIC || type == TYPE_STRING){
+        return;
+    }
+    if(value->num < TYPE_MIN[type] || value->num > TYPE_MAX[type]){
+        printloc(value->token.loc);
+        logf(" ");
+        range_error(type, name, value->num);
+    }
+}
+
+// set when statements were removed, moved declarations need resolving again
+bool optimizer_removed = false;
+
+void optimize_block(Block *block);
+
+// Returns false when statement can be dropped
+bool optimize_statement(Stmt *stmt){
+    switch(stmt->kind){
+        case STMT_DECL:
+            if(stmt->decl.size != NULL){
+                fold_expr(stmt->decl.size);
+            }
+            if(stmt->decl.value != NULL){
+                fold_expr(stmt->decl.value);
+            }
+            if(stmt->decl.value != NULL && stmt->decl.sig.modifyer != MOD_ARRAY){
+                check_folded(stmt->decl.value, stmt->decl.sig.type, stmt->decl.sig.name);
+            }
+            break;
+        case STMT_ASSIGN:{
+            fold_expr(stmt->assign.value);
+            if(stmt->assign.target->kind == EXPR_INDEX){
+                fold_expr(stmt->assign.target->index);
+            }
+            Expr *target = stmt->assign.target;
+            if(stmt->assign.op == BINOP_NONE && (target->kind == EXPR_INDEX || target->decl->modifyer != MOD_ARRAY)){
+                check_folded(stmt->assign.value, target->decl->type, target->token.sv);
+            }
+            break;
+        }
+        case STMT_EXPR:
+            fold_expr(stmt->expr);
+            break;
+        case STMT_RETURN:
+            if(stmt->expr != NULL){
+                fold_expr(stmt->expr);
+            }
+            break;
+        case STMT_IF:{
+            Expr *cond = stmt->if_stmt.cond;
+            fold_expr(cond);
+            optimize_block(&stmt->if_stmt.then_block);
+            optimize_block(&stmt->if_stmt.else_block);
+            if(cond->kind != EXPR_NUMERIC){
+                break;
+            }
+            // the taken branch is kept as then block of always true if
+            if(cond->num == 0){
+                if(stmt->if_stmt.else_block.stmtc == 0){
+                    optimizer_report(stmt->token, "removed if with false condition");
+                    return false;
+                }
+                optimizer_report(stmt->token, "removed then branch of if with false condition");
+                stmt->if_stmt.then_block = stmt->if_stmt.else_block;
+                cond->num = 1;
+            } else if(stmt->if_stmt.else_block.stmtc > 0){
+                optimizer_report(stmt->token, "removed else branch of if with true condition");
+            }
+            stmt->if_stmt.else_block = (Block){0};
+            break;
+        }
+        case STMT_WHILE:
+            fold_expr(stmt->while_stmt.cond);
+            optimize_block(&stmt->while_stmt.body);
+            if(stmt->while_stmt.cond->kind == EXPR_NUMERIC){
+                if(stmt->while_stmt.cond->num == 0){
+                    optimizer_report(stmt->token, "removed while with false condition");
+                    return false;
+                }
+                optimizer_report(stmt->token, "while condition is always true, loop is a plain jump");
+            }
+            break;
+        case STMT_FOR:
+            optimize_statement(stmt->for_stmt.init);
+            fold_expr(stmt->for_stmt.cond);
+            optimize_statement(stmt->for_stmt.update);
+            optimize_block(&stmt->for_stmt.body);
+            break;
+        case STMT_BREAK:
+        case STMT_CONTINUE:
+            break;
+    }
+    return true;
+}
+
+void optimize_block(Block *block){
+    size_t kept = 0;
+    for(size_t i = 0; i<block->stmtc; i++){
+        if(optimize_statement(&block->stmts[i])){
+            block->stmts[kept++] = block->stmts[i];
+        } else {
+            optimizer_removed = true;
+        }
+    }
+    block->stmtc = kept;
+}
+
+// Returns true when function has to be resolved again
+bool optimize_function(Func *fn){
+    optimizer_removed = false;
+    optimize_block(&fn->block);
+    return optimizer_removed;
+}
+
+// Bounds check elimination: inside 'while(i < a.length)' and
+// 'for(...; i < a.length; ...;)' a[i] is in range as long as i is never
+// negative and the body has not changed i yet. Runs on resolved trees,
+// variables are told apart by their declarations.
+
+typedef struct {
+    Var_signature *index;
+    Var_signature *array;
+} LoopBound;
+
+bool is_var(Expr *expr, Var_signature *decl){
+    return expr->kind == EXPR_VAR && expr->decl == decl;
+}
+
+// Matches 'i < a.length' and 'a.length > i'
+bool loop_bound(Expr *cond, LoopBound *bound){
+    if(cond->kind != EXPR_BINARY){
+        return false;
+    }
+    Expr *index  = cond->binary.lhs;
+    Expr *length = cond->binary.rhs;
+    if(cond->binary.op == BINOP_GREATER){
+        index  = cond->binary.rhs;
+        length = cond->binary.lhs;
+    } else if(cond->binary.op != BINOP_LESS){
+        return false;
+    }
+    if(index->kind != EXPR_VAR || length->kind != EXPR_LENGTH || length->decl->type == TYPE_STRING){
+        return false; // strings change their length on assignment
+    }
+    *bound = (LoopBound){.index = index->decl, .array = length->decl};
+    return true;
+}
+
+// True when expression passes var to std function writing its arguments back
+bool std_writes(Expr *expr, Var_signature *var){
+    switch(expr->kind){
+        case EXPR_INDEX:
+            return std_writes(expr->index, var);
+        case EXPR_BINARY:
+            return std_writes(expr->binary.lhs, var) || std_writes(expr->binary.rhs, var);
+        case EXPR_CALL:
+        case EXPR_STDCALL:
+            for(size_t i = 0; i<expr->call.argc; i++){
+                Expr *arg = expr->call.args[i];
+                if((expr->kind == EXPR_STDCALL && is_var(arg, var) && stdcall_writes_args(expr->call.std))
+                        || std_writes(arg, var)){
+                    return true;
+                }
+            }
+            return false;
+        default:
+            return false;
+    }
+}
+
+bool stmt_writes(Stmt *stmt, Var_signature *var);
+
+bool block_writes(Block *block, Var_signature *var){
+    for(size_t i = 0; i<block->stmtc; i++){
+        if(stmt_writes(&block->stmts[i], var)){
+            return true;
+        }
+    }
+    return false;
+}
+
+// Every write of var, when never_negative holds these are plain assignments
+bool stmt_writes(Stmt *stmt, Var_signature *var){
+    switch(stmt->kind){
+        case STMT_DECL:
+            return (stmt->decl.size != NULL && std_writes(stmt->decl.size, var))
+                || (stmt->decl.value != NULL && std_writes(stmt->decl.value, var));
+        case STMT_ASSIGN:
+            return is_var(stmt->assign.target, var)
+                || (stmt->assign.target->kind == EXPR_INDEX && std_writes(stmt->assign.target->index, var))
+                || std_writes(stmt->assign.value, var);
+        case STMT_EXPR:
+        case STMT_RETURN:
+            return stmt->expr != NULL && std_writes(stmt->expr, var);
+        case STMT_IF:
+            return std_writes(stmt->if_stmt.cond, var)
+                || block_writes(&stmt->if_stmt.then_block, var)
+                || block_writes(&stmt->if_stmt.else_block, var);
+        case STMT_WHILE:
+            return std_writes(stmt->while_stmt.cond, var) || block_writes(&stmt->while_stmt.body, var);
+        case STMT_FOR:
+            return stmt_writes(stmt->for_stmt.init, var)
+                || std_writes(stmt->for_stmt.cond, var)
+                || stmt_writes(stmt->for_stmt.update, var)
+                || block_writes(&stmt->for_stmt.body, var);
+        default:
+            return false;
+    }
+}
+
+bool is_non_negative(Expr *expr){
+    return expr->kind == EXPR_NUMERIC && expr->num >= 0;
+}
+
+// Local declared in block, starting non-negative and only set to or
+// increased by non-negative literals. Parameters are never proven.
+bool never_negative(Block *block, Var_signature *var, bool *declared){
+    for(size_t i = 0; i<block->stmtc; i++){
+        Stmt *stmt = &block->stmts[i];
+        switch(stmt->kind){
+            case STMT_DECL:
+                if(&stmt->decl.sig == var){
+                    *declared = true;
+                    if(stmt->decl.value != NULL && !is_non_negative(stmt->decl.value)){
+                        return false;
+                    }
+                }
+                if(stmt_writes(stmt, var)){
+                    return false;
+                }
+                break;
+            case STMT_ASSIGN:
+                if(is_var(stmt->assign.target, var)){
+                    enum BinopEnum op = stmt->assign.op;
+                    if((op != BINOP_NONE && op != BINOP_ADD && op != BINOP_MUL) || !is_non_negative(stmt->assign.value)){
+                        return false;
+                    }
+                } else if(stmt_writes(stmt, var)){
+                    return false;
+                }
+                break;
+            case STMT_EXPR:
+            case STMT_RETURN:
+                if(stmt_writes(stmt, var)){
+                    return false;
+                }
+                break;
+            case STMT_IF:
+                if(std_writes(stmt->if_stmt.cond, var)
+                        || !never_negative(&stmt->if_stmt.then_block, var, declared)
+                        || !never_negative(&stmt->if_stmt.else_block, var, declared)){
+                    return false;
+                }
+                break;
+            case STMT_WHILE:
+                if(std_writes(stmt->while_stmt.cond, var) || !never_negative(&stmt->while_stmt.body, var, declared)){
+                    return false;
+                }
+                break;
+            case STMT_FOR:{
+                Block header = {.stmts = stmt->for_stmt.init, .stmtc = 1};
+                Block update = {.stmts = stmt->for_stmt.update, .stmtc = 1};
+                if(std_writes(stmt->for_stmt.cond, var)
+                        || !never_negative(&header, var, declared) || !never_negative(&update, var, declared)
+                        || !never_negative(&stmt->for_stmt.body, var, declared)){
+                    return false;
+                }
+                break;
+            }
+            default:
+                break;
+        }
+    }
+    return true;
+}
+
+void mark_in_range(Expr *expr, LoopBound *bound){
+    switch(expr->kind){
+        case EXPR_INDEX:
+            if(expr->decl == bound->array && is_var(expr->index, bound->index) && !expr->in_range){
+                expr->in_range = true;
+                optimizer_report(expr->token, "index is in range, removed bounds check");
+            }
+            mark_in_range(expr->index, bound);
+            break;
+        case EXPR_BINARY:
+            mark_in_range(expr->binary.lhs, bound);
+            mark_in_range(expr->binary.rhs, bound);
+            break;
+        case EXPR_CALL:
+        case EXPR_STDCALL:
+            for(size_t i = 0; i<expr->call.argc; i++){
+                mark_in_range(expr->call.args[i], bound);
+            }
+            break;
+        default:
+            break;
+    }
+}
+
+// Walks loop body in order, returns whether index was changed on some path
+bool mark_block(Block *block, LoopBound *bound, bool changed){
+    for(size_t i = 0; i<block->stmtc && !changed; i++){
+        Stmt *stmt = &block->stmts[i];
+        switch(stmt->kind){
+            case STMT_DECL:
+                if(stmt->decl.size != NULL){
+                    mark_in_range(stmt->decl.size, bound);
+                }
+                if(stmt->decl.value != NULL){
+                    mark_in_range(stmt->decl.value, bound);
+                }
+                break;
+            case STMT_ASSIGN:
+                mark_in_range(stmt->assign.target, bound);
+                mark_in_range(stmt->assign.value, bound);
+                changed = is_var(stmt->assign.target, bound->index);
+                break;
+            case STMT_EXPR:
+            case STMT_RETURN:
+                if(stmt->expr != NULL){
+                    mark_in_range(stmt->expr, bound);
+                }
+                break;
+            case STMT_IF:
+                mark_in_range(stmt->if_stmt.cond, bound);
+                changed = mark_block(&stmt->if_stmt.then_block, bound, false)
+                        | mark_block(&stmt->if_stmt.else_block, bound, false);
+                break;
+            case STMT_WHILE:
+            case STMT_FOR:
+                // later iterations of inner loop would see the change
+                if(stmt_writes(stmt, bound->index)){
+                    return true;
+                }
+                if(stmt->kind == STMT_WHILE){
+                    mark_in_range(stmt->while_stmt.cond, bound);
+                    mark_block(&stmt->while_stmt.body, bound, false);
+                } else {
+                    Block header = {.stmts = stmt->for_stmt.init, .stmtc = 1};
+                    mark_block(&header, bound, false);
+                    mark_in_range(stmt->for_stmt.cond, bound);
+                    mark_block(&stmt->for_stmt.body, bound, false);
+                }
+                break;
+            default:
+                break;
+        }
+    }
+    return changed;
+}
+
+void eliminate_in_loop(Func *fn, Expr *cond, Block *body){
+    LoopBound bound;
+    bool declared = false;
+    if(loop_bound(cond, &bound) && never_negative(&fn->block, bound.index, &declared) && declared){
+        mark_block(body, &bound, false);
+    }
+}
+
+void eliminate_in_block(Func *fn, Block *block){
+    for(size_t i = 0; i<block->stmtc; i++){
+        Stmt *stmt = &block->stmts[i];
+        switch(stmt->kind){
+            case STMT_IF:
+                eliminate_in_block(fn, &stmt->if_stmt.then_block);
+                eliminate_in_block(fn, &stmt->if_stmt.else_block);
+                break;
+            case STMT_WHILE:
+                eliminate_in_loop(fn, stmt->while_stmt.cond, &stmt->while_stmt.body);
+                eliminate_in_block(fn, &stmt->while_stmt.body);
+                break;
+            case STMT_FOR:
+                eliminate_in_loop(fn, stmt->for_stmt.cond, &stmt->for_stmt.body);
+                eliminate_in_block(fn, &stmt->for_stmt.body);
+                break;
+            default:
+                break;
+        }
+    }
+}
+
+// Needs declarations bound, so runs after function is resolved for good
+void eliminate_bounds_checks(Func *fn){
+    eliminate_in_block(fn, &fn->block);
+}
@@ -0,0 +1,410 @@
+#include "types.h"
+#include "functions.h"
+
+// Recursive descent parser: turns the token array of a function body
+// into statement and expression trees once, at load time.
+
+Token parser_peek(Parser *this, size_t offset){
+    if(this->pos+offset >= this->count){
+        return this->tokens[this->count-1];
+    }
+    return this->tokens[this->pos+offset];
+}
+
+Token parser_next(Parser *this){
+    Token token = parser_peek(this, 0);
+    if(this->pos < this->count){
+        this->pos++;
+    }
+    return token;
+}
+
+Token parser_expect(Parser *this, enum TokenEnum type, char *what){
+    Token token = parser_next(this);
+    if(token.type != type){
+        logf("\n");
+        printloc(token.loc);
+        printf(" Error: expected %s, got '%.*s'\n", what, SVVARG(token.sv));
+        exit(1);
+    }
+    return token;
+}
+
+Expr *new_expr(enum ExprEnum kind, Token token){
+    Expr *expr = calloc(1, sizeof(Expr));
+    expr->kind  = kind;
+    expr->token = token;
+    return expr;
+}
+
+void push_expr(Expr *call, Expr *arg){
+    call->call.args = realloc(call->call.args, sizeof(Expr*)*(call->call.argc+1));
+    call->call.args[call->call.argc++] = arg;
+}
+
+void push_stmt(Block *block, Stmt stmt){
+    block->stmts = realloc(block->stmts, sizeof(Stmt)*(block->stmtc+1));
+    block->stmts[block->stmtc++] = stmt;
+}
+
+// std arguments are juxtaposed primaries: std.print "a=" a "\n";
+// inside expressions they are wrapped in parens: std.random()
+Expr *parse_stdcall(Parser *this, bool statement){
+    Token token = parser_next(this); // 'std'
+    if(parser_peek(this, 0).type != TOKEN_DOT){
+        token = parser_peek(this, 0);
+        TOKENERROR("expected '.' after 'std' in stdcall");
+    }
+    parser_next(this);
+    token = parser_expect(this, TOKEN_NAME, "std function name");
+    Expr *call = new_expr(EXPR_STDCALL, token);
+    enum TokenEnum closing = TOKEN_SEMICOLON;
+    bool empty_parens = parser_peek(this, 0).type == TOKEN_OPAREN && parser_peek(this, 1).type == TOKEN_CPAREN;
+    if(!statement || empty_parens){
+        parser_expect(this, TOKEN_OPAREN, "'(' after std function name");
+        closing = TOKEN_CPAREN;
+    }
+    while(parser_peek(this, 0).type != closing){
+        if(parser_peek(this, 0).type == TOKEN_COMMA){
+            parser_next(this);
+            continue;
+        }
+        if(parser_peek(this, 0).type == TOKEN_CCURLY){
+            token = parser_peek(this, 0);
+            TOKENERROR(" Error: You dumbass forgot semicolon, got ");
+        }
+        push_expr(call, parse_primary(this));
+    }
+    if(closing == TOKEN_CPAREN){
+        parser_next(this);
+    }
+    return call;
+}
+
+Expr *parse_name(Parser *this){
+    Token token = parser_peek(this, 0);
+    if(token.type == TOKEN_STD){
+        return parse_stdcall(this, false);
+    }
+    parser_next(this);
+    Expr *expr;
+    switch(parser_peek(this, 0).type){
+        case TOKEN_OPAREN:
+            parser_next(this);
+            expr = new_expr(EXPR_CALL, token);
+            while(parser_peek(this, 0).type != TOKEN_CPAREN){
+                push_expr(expr, parse_expr(this));
+                if(parser_peek(this, 0).type == TOKEN_COMMA){
+                    parser_next(this);
+                } else if(parser_peek(this, 0).type != TOKEN_CPAREN){
+                    token = parser_peek(this, 0);
+                    TOKENERROR(" Error: expected ',' or ')' in function call, got ");
+                }
+            }
+            parser_next(this);
+            return expr;
+        case TOKEN_OSQUAR:
+            parser_next(this);
+            expr = new_expr(EXPR_INDEX, token);
+            expr->index = parse_expr(this);
+            parser_expect(this, TOKEN_CSQUAR, "']'");
+            return expr;
+        case TOKEN_DOT:
+            parser_next(this);
+            expr = new_expr(EXPR_LENGTH, token);
+            token = parser_expect(this, TOKEN_NAME, "array field");
+            if(SVCMP(token.sv, "length")!=0){
+                TOKENERROR(" Error, array has no such field ");
+            }
+            return expr;
+        default:
+            return new_expr(EXPR_VAR, token);
+    }
+}
+
+Expr *parse_primary(Parser *this){
+    Token token = parser_peek(this, 0);
+    Expr *expr;
+    switch(token.type){
+        case TOKEN_NUMERIC:
+            parser_next(this);
+            expr = new_expr(EXPR_NUMERIC, token);
+            expr->num = SVTOL(token.sv);
+            return expr;
+        case TOKEN_TRUE:
+        case TOKEN_FALSE:
+            parser_next(this);
+            expr = new_expr(EXPR_NUMERIC, token);
+            expr->num = token.type == TOKEN_TRUE;
+            return expr;
+        case TOKEN_STR_LITERAL:
+            parser_next(this);
+            return new_expr(EXPR_STRING, token);
+        case TOKEN_OPAREN:
+            parser_next(this);
+            expr = parse_expr(this);
+            parser_expect(this, TOKEN_CPAREN, "')'");
+            return expr;
+        case TOKEN_OP_MINUS: // unary minus is parsed as 0-operand
+            parser_next(this);
+            expr = new_expr(EXPR_BINARY, token);
+            expr->binary.op  = BINOP_SUB;
+            expr->binary.lhs = new_expr(EXPR_NUMERIC, token);
+            expr->binary.rhs = parse_primary(this);
+            return expr;
+        case TOKEN_STD:
+        case TOKEN_NAME:
+            return parse_name(this);
+        default:
+            TOKENERROR(" Error: expected expression, got ");
+    }
+}
+
+int BINOP_PREC[] = {
+    [BINOP_MUL       ] = 3,
+    [BINOP_DIV       ] = 3,
+    [BINOP_MOD       ] = 3,
+    [BINOP_ADD       ] = 2,
+    [BINOP_SUB       ] = 2,
+    [BINOP_LESS      ] = 1,
+    [BINOP_LESS_EQ   ] = 1,
+    [BINOP_GREATER   ] = 1,
+    [BINOP_GREATER_EQ] = 1,
+    [BINOP_EQ        ] = 1,
+    [BINOP_NOT_EQ    ] = 1,
+};
+
+// Comparison operators are two tokens wide ('<' '='), width is returned in len
+enum BinopEnum parser_peek_binop(Parser *this, size_t *len){
+    Token token = parser_peek(this, 0);
+    Token next  = parser_peek(this, 1);
+    *len = 1;
+    switch(token.type){
+        case TOKEN_OP_PLUS:  return BINOP_ADD;
+        case TOKEN_OP_MINUS: return BINOP_SUB;
+        case TOKEN_OP_MUL:   return BINOP_MUL;
+        case TOKEN_OP_DIV:   return BINOP_DIV;
+        case TOKEN_OP_MOD:   return BINOP_MOD;
+        case TOKEN_OP_LESS:
+            if(next.type==TOKEN_EQUAL_SIGN){
+                *len = 2;
+                return BINOP_LESS_EQ;
+            }
+            return BINOP_LESS;
+        case TOKEN_OP_GREATER:
+            if(next.type==TOKEN_EQUAL_SIGN){
+                *len = 2;
+                return BINOP_GREATER_EQ;
+            }
+            return BINOP_GREATER;
+        case TOKEN_OP_NOT:
+            if(next.type!=TOKEN_EQUAL_SIGN){
+                printloc(next.loc);
+                logf(" Error: expected '!=', got !%.*s\n", SVVARG(next.sv));
+                exit(1);
+            }
+            *len = 2;
+            return BINOP_NOT_EQ;
+        case TOKEN_EQUAL_SIGN:
+            if(next.type!=TOKEN_EQUAL_SIGN){
+                printloc(next.loc);
+                logf(" Error: assignation on condition, expected '==', got =%.*s\n", SVVARG(next.sv));
+                exit(1);
+            }
+            *len = 2;
+            return BINOP_EQ;
+        default:
+            return BINOP_NONE;
+    }
+}
+
+// Precedence climbing, all binary operators are left associative
+Expr *parse_binary(Parser *this, int min_prec){
+    Expr *lhs = parse_primary(this);
+    for(;;){
+        size_t len;
+        Token token = parser_peek(this, 0);
+        enum BinopEnum op = parser_peek_binop(this, &len);
+        if(op == BINOP_NONE || BINOP_PREC[op] < min_prec){
+            return lhs;
+        }
+        this->pos += len;
+        Expr *expr = new_expr(EXPR_BINARY, token);
+        expr->binary.op  = op;
+        expr->binary.lhs = lhs;
+        expr->binary.rhs = parse_binary(this, BINOP_PREC[op]+1);
+        lhs = expr;
+    }
+}
+
+Expr *parse_expr(Parser *this){
+    return parse_binary(this, 1);
+}
+
+Stmt parse_declaration(Parser *this){
+    Token token = parser_next(this); // var type
+    Stmt stmt = {.kind = STMT_DECL};
+    stmt.decl.sig.type = token_variable_type(token);
+    token = parser_expect(this, TOKEN_NAME, "variable name");
+    stmt.token = token;
+    stmt.decl.sig.name = token.sv;
+    stmt.decl.sig.modifyer = (stmt.decl.sig.type==TYPE_STRING) ? MOD_ARRAY : MOD_NO_MOD;
+    if(parser_peek(this, 0).type == TOKEN_OSQUAR){
+        parser_next(this);
+        stmt.decl.sig.modifyer = MOD_ARRAY;
+        stmt.decl.size = parse_expr(this);
+        parser_expect(this, TOKEN_CSQUAR, "']'");
+    }
+    if(parser_peek(this, 0).type == TOKEN_EQUAL_SIGN){
+        token = parser_next(this);
+        if(stmt.decl.size != NULL){
+            TOKENERROR(" Error: array initialisation not supported, got ");
+        }
+        stmt.decl.value = parse_expr(this);
+    }
+    parser_expect(this, TOKEN_SEMICOLON, "';'");
+    return stmt;
+}
+
+Stmt parse_assignment(Parser *this){
+    Token token = parser_next(this); // var name
+    Stmt stmt = {.kind = STMT_ASSIGN, .token = token};
+    if(parser_peek(this, 0).type == TOKEN_OSQUAR){
+        parser_next(this);
+        stmt.assign.target = new_expr(EXPR_INDEX, token);
+        stmt.assign.target->index = parse_expr(this);
+        parser_expect(this, TOKEN_CSQUAR, "']'");
+    } else {
+        stmt.assign.target = new_expr(EXPR_VAR, token);
+    }
+    token = parser_next(this);
+    switch(token.type){
+        case TOKEN_EQUAL_SIGN:
+            stmt.assign.op = BINOP_NONE;
+            break;
+        case TOKEN_OP_PLUS:  stmt.assign.op = BINOP_ADD; break;
+        case TOKEN_OP_MINUS: stmt.assign.op = BINOP_SUB; break;
+        case TOKEN_OP_MUL:   stmt.assign.op = BINOP_MUL; break;
+        case TOKEN_OP_DIV:   stmt.assign.op = BINOP_DIV; break;
+        case TOKEN_OP_MOD:   stmt.assign.op = BINOP_MOD; break;
+        default:
+            TOKENERROR(" Error: expected '=', got ");
+    }
+    if(stmt.assign.op != BINOP_NONE){
+        token = parser_next(this);
+        if(token.type!=TOKEN_EQUAL_SIGN){
+            TOKENERROR(" Error: expected '=', got ");
+        }
+    }
+    stmt.assign.value = parse_expr(this);
+    parser_expect(this, TOKEN_SEMICOLON, "';'");
+    return stmt;
+}
+
+// Block extent comes from bracket pairs found while collecting tokens
+Block parse_block(Parser *this){
+    Block block = {0};
+    size_t close = (this->pos < this->count) ? this->pairs[this->pos] : this->pos;
+    parser_expect(this, TOKEN_OCURLY, "'{'");
+    while(this->pos < close){
+        push_stmt(&block, parse_statement(this));
+    }
+    if(this->pos != close){
+        Token token = this->tokens[close];
+        RUNTIMEERROR(" Error: statement runs past the end of block");
+    }
+    parser_next(this);
+    return block;
+}
+
+Stmt parse_statement(Parser *this){
+    Token token = parser_peek(this, 0);
+    Stmt stmt = {.token = token};
+    switch(token.type){
+        case TOKEN_TYPE:
+            return parse_declaration(this);
+        case TOKEN_STD:
+            stmt.kind = STMT_EXPR;
+            stmt.expr = parse_stdcall(this, true);
+            parser_expect(this, TOKEN_SEMICOLON, "';'");
+            return stmt;
+        case TOKEN_NAME:
+            if(parser_peek(this, 1).type == TOKEN_OPAREN){
+                stmt.kind = STMT_EXPR;
+                stmt.expr = parse_name(this);
+                parser_expect(this, TOKEN_SEMICOLON, "';'");
+                return stmt;
+            }
+            return parse_assignment(this);
+        case TOKEN_IF:
+            parser_next(this);
+            stmt.kind = STMT_IF;
+            parser_expect(this, TOKEN_OPAREN, "'('");
+            stmt.if_stmt.cond = parse_expr(this);
+            parser_expect(this, TOKEN_CPAREN, "')'");
+            stmt.if_stmt.then_block = parse_block(this);
+            if(parser_peek(this, 0).type == TOKEN_ELSE){
+                parser_next(this);
+                stmt.if_stmt.else_block = parse_block(this);
+            }
+            return stmt;
+        case TOKEN_WHILE:
+            parser_next(this);
+            stmt.kind = STMT_WHILE;
+            parser_expect(this, TOKEN_OPAREN, "'('");
+            stmt.while_stmt.cond = parse_expr(this);
+            parser_expect(this, TOKEN_CPAREN, "')'");
+            this->loop_depth++;
+            stmt.while_stmt.body = parse_block(this);
+            this->loop_depth--;
+            return stmt;
+        case TOKEN_FOR:
+            parser_next(this);
+            stmt.kind = STMT_FOR;
+            parser_expect(this, TOKEN_OPAREN, "'('");
+            token = parser_peek(this, 0);
+            if(token_variable_type(token)==TYPE_NOT_A_TYPE){
+                RUNTIMEERROR(" Error: for loops must initialize variable");
+            }
+            stmt.for_stmt.init = malloc(sizeof(Stmt));
+            *stmt.for_stmt.init = parse_declaration(this);
+            stmt.for_stmt.cond = parse_expr(this);
+            parser_expect(this, TOKEN_SEMICOLON, "';'");
+            stmt.for_stmt.update = malloc(sizeof(Stmt));
+            *stmt.for_stmt.update = parse_assignment(this);
+            parser_expect(this, TOKEN_CPAREN, "')'");
+            this->loop_depth++;
+            stmt.for_stmt.body = parse_block(this);
+            this->loop_depth--;
+            return stmt;
+        case TOKEN_RETURN:
+            parser_next(this);
+            stmt.kind = STMT_RETURN;
+            if(parser_peek(this, 0).type != TOKEN_SEMICOLON){
+                stmt.expr = parse_expr(this);
+            }
+            parser_expect(this, TOKEN_SEMICOLON, "';'");
+            return stmt;
+        case TOKEN_BREAK:
+        case TOKEN_CONTINUE:
+            parser_next(this);
+            if(this->loop_depth == 0){
+                TOKENERROR(" Error: outside of a loop ");
+            }
+            stmt.kind = (token.type==TOKEN_BREAK) ? STMT_BREAK : STMT_CONTINUE;
+            parser_expect(this, TOKEN_SEMICOLON, "';'");
+            return stmt;
+        default:
+            TOKENERROR(" Error: unexpected token ");
+    }
+}
+
+// Function body tokens end with the closing '}' of the function
+Block parse_function_body(CodeBlock body){
+    Parser parser = {.tokens = body.code, .count = body.exprc, .pairs = body.pairs};
+    Block block = {0};
+    while(parser.pos+1 < parser.count){
+        push_stmt(&block, parse_statement(&parser));
+    }
+    return block;
+}
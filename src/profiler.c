@@ -0,0 +1,196 @@
+#include <time.h>
+#include "types.h"
+#include "functions.h"
+
+// --profile: counts statements and splits wall time between source lines
+// and functions. Interpreters report statement starts, line changes,
+// calls and returns, without --profile, --stats or --sample-profile they
+// only test 'tracing'.
+
+bool profiling = false;
+bool tracing = false;          // interpreters report calls and returns
+bool trace_statements = false; // and statements, for --profile and --stats
+Profiler profiler = {0};
+
+double profile_now(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+void setup_profile(char *source, char *file_path){
+    profiler.source    = source;
+    profiler.file_path = file_path;
+    profiler.linec     = 2; // rows start at 1, last line may lack '\n'
+    for(char *c = source; *c; c++){
+        profiler.linec += (*c == '\n');
+    }
+    profiler.lines = calloc(profiler.linec, sizeof(LineProfile));
+    profiler.mark  = profile_now();
+    atexit(profile_report);
+}
+
+// Time since last switch goes to the line that was running
+void profile_switch(size_t row){
+    if(!profiling){
+        return;
+    }
+    double now = profile_now();
+    profiler.lines[profiler.row].self += now - profiler.mark;
+    profiler.mark = now;
+    profiler.row  = row;
+}
+
+void profile_statement(size_t row){
+    stats.statements++;
+    if(!profiling){
+        return;
+    }
+    if(row != profiler.row){
+        profile_switch(row);
+    }
+    profiler.lines[row].count++;
+}
+
+// Frame starts at last switch
+void profile_push(Func *fn){
+    if(fn->profile_id == 0){
+        profiler.funcs = realloc(profiler.funcs, sizeof(FuncProfile)*(profiler.funcc+1));
+        profiler.funcs[profiler.funcc] = (FuncProfile){.fn = fn};
+        fn->profile_id = ++profiler.funcc;
+    }
+    if(profiler.framec >= profiler.frame_cap){
+        profiler.frame_cap = profiler.frame_cap ? profiler.frame_cap*2 : 64;
+        profiler.frames = realloc(profiler.frames, sizeof(ProfileFrame)*profiler.frame_cap);
+    }
+    FuncProfile *func = &profiler.funcs[fn->profile_id-1];
+    func->calls++;
+    func->active++;
+    profiler.frames[profiler.framec++] = (ProfileFrame){
+        .func = fn->profile_id-1, .start = profiler.mark, .row = profiler.row
+    };
+}
+
+void profile_pop(void){
+    profile_switch(profiler.row);
+    ProfileFrame frame = profiler.frames[--profiler.framec];
+    FuncProfile *func = &profiler.funcs[frame.func];
+    double total = profiler.mark - frame.start;
+    func->self += total - frame.callees;
+    if(--func->active == 0){
+        func->total += total;
+    }
+    if(profiler.framec > 0){
+        profiler.frames[profiler.framec-1].callees += total;
+    } else {
+        profiler.elapsed += total;
+    }
+    profiler.row = frame.row;
+}
+
+void profile_leave(void){
+    if(sampling){
+        sample_pop();
+    }
+    if(profiling){
+        profile_pop();
+    }
+}
+
+void profile_enter(Func *fn, size_t row){
+    stats.user_calls++;
+    if(sampling){
+        sample_push(fn, row);
+    }
+    if(!profiling){
+        return;
+    }
+    profile_switch(profiler.row);
+    profile_push(fn);
+}
+
+// Returning function is replaced, both share one clock reading
+void profile_tail_call(Func *fn, size_t row){
+    stats.user_calls++;
+    stats.tail_calls++;
+    if(sampling){
+        sample_pop();
+        sample_push(fn, row);
+    }
+    if(!profiling){
+        return;
+    }
+    profile_pop();
+    profile_push(fn);
+}
+
+int compare_funcs_self(const void *a, const void *b){
+    double lhs = ((FuncProfile*)a)->self;
+    double rhs = ((FuncProfile*)b)->self;
+    return (lhs < rhs) - (lhs > rhs);
+}
+
+int compare_lines_self(const void *a, const void *b){
+    double lhs = profiler.lines[*(size_t*)a].self;
+    double rhs = profiler.lines[*(size_t*)b].self;
+    return (lhs < rhs) - (lhs > rhs);
+}
+
+#define PROFILE_HOT_LINES 20
+
+// Runs at exit, also after runtime errors. Frames still open are closed,
+// so time of unfinished calls is counted. Percents are of time spent in main.
+void profile_report(void){
+    if(!profiling || profiler.reported){
+        return;
+    }
+    profiler.reported = true;
+    while(profiler.framec > 0){
+        profile_pop();
+    }
+    out_flush(); // program output comes first on a shared terminal
+    double elapsed = profiler.elapsed;
+    double percent = elapsed > 0 ? 100 / elapsed : 0;
+
+    fprintf(stderr, "\n# profile of %s, %.3f ms\n", profiler.file_path, elapsed*1e3);
+    fprintf(stderr, "# %-24s %12s %12s %12s %7s\n", "function", "calls", "total ms", "self ms", "self %");
+    qsort(profiler.funcs, profiler.funcc, sizeof(FuncProfile), compare_funcs_self);
+    for(size_t i = 0; i<profiler.funcc; i++){
+        FuncProfile func = profiler.funcs[i];
+        func.fn->profile_id = 0;
+        fprintf(stderr, "  %-24.*s %12zu %12.3f %12.3f %6.2f%%\n", SVVARG(func.fn->name), func.calls,
+             func.total*1e3, func.self*1e3, func.self*percent);
+    }
+
+    size_t *hot = malloc(sizeof(size_t)*profiler.linec);
+    size_t hotc = 0;
+    for(size_t row = 1; row<profiler.linec; row++){
+        if(profiler.lines[row].count > 0 || profiler.lines[row].self > 0){
+            hot[hotc++] = row;
+        }
+    }
+    qsort(hot, hotc, sizeof(size_t), compare_lines_self);
+    fprintf(stderr, "# %-24s %12s %12s %7s\n", "line", "count", "self ms", "self %");
+    for(size_t i = 0; i<hotc && i<PROFILE_HOT_LINES; i++){
+        LineProfile line = profiler.lines[hot[i]];
+        fprintf(stderr, "  %-24zu %12zu %12.3f %6.2f%%\n", hot[i], line.count, line.self*1e3, line.self*percent);
+    }
+    free(hot);
+
+    fprintf(stderr, "# %12s %12s | source\n", "count", "self ms");
+    char *line = profiler.source;
+    for(size_t row = 1; *line; row++){
+        char *end = strchr(line, '\n');
+        int len = end ? end - line : (int)strlen(line);
+        LineProfile stats = profiler.lines[row];
+        if(stats.count > 0 || stats.self > 0){
+            fprintf(stderr, "  %12zu %12.3f | %.*s\n", stats.count, stats.self*1e3, len, line);
+        } else {
+            fprintf(stderr, "  %12s %12s | %.*s\n", "", "", len, line);
+        }
+        line = end ? end+1 : line+len;
+    }
+    free(profiler.lines);
+    free(profiler.funcs);
+    free(profiler.frames);
+}
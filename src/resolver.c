@@ -0,0 +1,213 @@
+#include "types.h"
+#include "functions.h"
+
+// Binds every variable name to a frame slot and every call to its
+// function once, at load time, after all functions are parsed.
+// Slots follow scopes: a scope takes slots above its parent and gives
+// them back when it ends, so sibling scopes share them.
+
+Local *resolve_lookup(Resolver *this, Token token){
+    stats.name_lookups++;
+    for(size_t i = this->localc; i>0; i--){
+        stats.locals_scanned++;
+        if(SVSVCMP(token.sv, this->locals[i-1].name)==0){
+            return &this->locals[i-1];
+        }
+    }
+    printloc(token.loc);
+    logf(" Error: could not find variable '%.*s'\n", SVVARG(token.sv));
+    exit(1);
+}
+
+size_t resolve_declare(Resolver *this, Var_signature *sig, Token token){
+    for(size_t i = this->localc; i>0 && this->locals[i-1].depth == this->depth; i--){
+        if(SVSVCMP(sig->name, this->locals[i-1].name)==0){
+            logf("'%.*s' on depth %zu\n", SVVARG(sig->name), this->depth);
+            RUNTIMEERROR(" Error: variable exists");
+        }
+    }
+    Local local = {.name = sig->name, .type = sig->type, .modifyer = sig->modifyer,
+                   .reg = this->next_slot++, .depth = this->depth, .sig = sig};
+    if(this->next_slot > this->fn->slotc){
+        this->fn->slotc = this->next_slot;
+    }
+    this->locals = realloc(this->locals, sizeof(Local)*(this->localc+1));
+    this->locals[this->localc++] = local;
+    return local.reg;
+}
+
+void resolve_leave(Resolver *this, size_t slot_mark){
+    while(this->localc > 0 && this->locals[this->localc-1].depth == this->depth){
+        this->localc--;
+    }
+    this->depth--;
+    this->next_slot = slot_mark;
+}
+
+void resolve_expr(Resolver *this, Expr *expr){
+    switch(expr->kind){
+        case EXPR_INDEX:
+            resolve_expr(this, expr->index);
+            /* fallthrough */
+        case EXPR_VAR:
+        case EXPR_LENGTH:{
+            Local *local = resolve_lookup(this, expr->token);
+            expr->slot = local->reg;
+            expr->decl = local->sig;
+            break;
+        }
+        case EXPR_BINARY:
+            resolve_expr(this, expr->binary.lhs);
+            resolve_expr(this, expr->binary.rhs);
+            break;
+        case EXPR_CALL:{
+            Token token = expr->token;
+            expr->call.fn = find_function(token.sv);
+            if(expr->call.fn == NULL){
+                TOKENERROR(" Error: unknown function ");
+            }
+            if(expr->call.argc != expr->call.fn->argc){
+                printloc(token.loc);
+                logf(" Error: '%.*s' expects %zu arguments, got %zu\n",
+                        SVVARG(token.sv), expr->call.fn->argc, expr->call.argc);
+                exit(1);
+            }
+        }
+            /* fallthrough */
+        case EXPR_STDCALL:
+            if(expr->kind == EXPR_STDCALL){
+                Token token = expr->token;
+                expr->call.std = find_stdcall(token.sv);
+                if(expr->call.std == NULL){
+                    TOKENERROR(" Error: unknown std function ");
+                }
+                if(expr->call.argc > STD_MAX_ARGS){
+                    TOKENERROR(" Error: too many arguments for std function ");
+                }
+            }
+            for(size_t i = 0; i<expr->call.argc; i++){
+                resolve_expr(this, expr->call.args[i]);
+            }
+            break;
+        default:
+            break;
+    }
+}
+
+// 'return f(...)' may drop the frame before f runs, unless f borrows array
+// owned by the frame: only arrays borrowed by the function itself are passed on
+bool resolve_tail_call(Resolver *this, Expr *call){
+    for(size_t i = 0; i<call->call.argc; i++){
+        Var_signature *sig = call->call.args[i]->decl;
+        if(call->call.args[i]->kind != EXPR_VAR || sig->modifyer != MOD_ARRAY || sig->type == TYPE_STRING){
+            continue;
+        }
+        if(sig < this->fn->args || sig >= this->fn->args + this->fn->argc || sig->copy){
+            return false;
+        }
+    }
+    return true;
+}
+
+void resolve_statement(Resolver *this, Stmt *stmt);
+
+void resolve_statements(Resolver *this, Block *block){
+    block->slot_start = this->next_slot;
+    for(size_t i = 0; i<block->stmtc; i++){
+        resolve_statement(this, &block->stmts[i]);
+        if(block->stmts[i].kind == STMT_DECL){
+            block->slot_end = block->stmts[i].decl.slot+1;
+        }
+    }
+    if(block->slot_end < block->slot_start){
+        block->slot_end = block->slot_start;
+    }
+}
+
+void resolve_block(Resolver *this, Block *block){
+    size_t slot_mark = this->next_slot;
+    this->depth++;
+    resolve_statements(this, block);
+    resolve_leave(this, slot_mark);
+}
+
+void resolve_statement(Resolver *this, Stmt *stmt){
+    switch(stmt->kind){
+        case STMT_DECL:
+            // initializer sees the outer variable of the same name
+            if(stmt->decl.size != NULL){
+                resolve_expr(this, stmt->decl.size);
+            }
+            if(stmt->decl.value != NULL){
+                resolve_expr(this, stmt->decl.value);
+            }
+            stmt->decl.slot = resolve_declare(this, &stmt->decl.sig, stmt->token);
+            break;
+        case STMT_ASSIGN:{
+            resolve_expr(this, stmt->assign.value);
+            resolve_expr(this, stmt->assign.target);
+            // whole array takes items of array of same type
+            Expr *target = stmt->assign.target;
+            Expr *value  = stmt->assign.value;
+            if(target->kind == EXPR_VAR && target->decl->modifyer == MOD_ARRAY && target->decl->type != TYPE_STRING){
+                if(value->kind != EXPR_VAR || value->decl->modifyer != MOD_ARRAY
+                        || value->decl->type != target->decl->type || stmt->assign.op != BINOP_NONE){
+                    printloc(stmt->token.loc);
+                    logf(" Error: array '%s %.*s[]' can only be assigned '%s' array\n",
+                            TYPE_TO_STR[target->decl->type], SVVARG(target->token.sv), TYPE_TO_STR[target->decl->type]);
+                    exit(1);
+                }
+            }
+            break;
+        }
+        case STMT_EXPR:
+            resolve_expr(this, stmt->expr);
+            break;
+        case STMT_IF:
+            resolve_expr(this, stmt->if_stmt.cond);
+            resolve_block(this, &stmt->if_stmt.then_block);
+            resolve_block(this, &stmt->if_stmt.else_block);
+            break;
+        case STMT_WHILE:
+            resolve_expr(this, stmt->while_stmt.cond);
+            resolve_block(this, &stmt->while_stmt.body);
+            break;
+        case STMT_FOR:{
+            // iterator lives one level deeper, loop body two levels deeper
+            size_t slot_mark = this->next_slot;
+            this->depth++;
+            resolve_statement(this, stmt->for_stmt.init);
+            resolve_expr(this, stmt->for_stmt.cond);
+            resolve_block(this, &stmt->for_stmt.body);
+            resolve_statement(this, stmt->for_stmt.update);
+            resolve_leave(this, slot_mark);
+            break;
+        }
+        case STMT_RETURN:
+            if(stmt->expr != NULL){
+                resolve_expr(this, stmt->expr);
+                if(stmt->expr->kind == EXPR_CALL){
+                    stmt->expr->call.tail = resolve_tail_call(this, stmt->expr);
+                }
+            }
+            break;
+        case STMT_BREAK:
+        case STMT_CONTINUE:
+            break;
+    }
+}
+
+// Arguments take slots 0..argc-1, function body shares their scope
+void resolve_function(Func *fn){
+    Resolver resolver = {.fn = fn, .depth = 1};
+    Resolver *this = &resolver;
+    Token token = fn->body.code[fn->body.exprc-1];
+    fn->slotc = 0;
+    for(size_t i = 0; i<fn->argc; i++){
+        token.sv = fn->args[i].name;
+        resolve_declare(this, &fn->args[i], token);
+    }
+    resolve_statements(this, &fn->block);
+    fn->block.slot_start = 0;
+    free(resolver.locals);
+}
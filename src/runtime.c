@@ -0,0 +1,208 @@
+#include "runtime.h"
+
+// Values, arrays and their errors, shared by every engine and by programs
+// built from --emit-c output
+
+Location global_location;
+// TODO: verbose output on error
+bool verbose = false;
+
+void printloc(Location loc){
+    logf("%s:%lu:%lu", loc.file_path, loc.row, loc.col);
+}
+
+ssize_t get_type_size_in_bytes(enum TypeEnum type){
+    switch(type){
+        case TYPE_I8:
+        case TYPE_U8:
+            return 1;
+        case TYPE_I32:
+        case TYPE_U32:
+            return 4;
+        case TYPE_I64:
+        case TYPE_U64:
+            return 8;
+        case TYPE_STRING:
+            return sizeof(Variable);
+        default:
+           return -1;
+    }
+}
+
+void type_mismatch_error(Location loc, enum TypeEnum type, SView name, enum TypeEnum src_type){
+    printloc(loc);
+    logf(" Error on assignation of '%s %.*s' to type '%s'\n",
+            TYPE_TO_STR[type],
+            SVVARG(name),
+            TYPE_TO_STR[src_type]);
+    exit(1);
+}
+
+void range_error(enum TypeEnum type, SView name, ssize_t value){
+    logf("Error on assignation, %s %s in (tried assigning %zd to '%.*s')\n",
+            TYPE_TO_STR[type],
+            (value<0)?"underflow":"overflow",
+            value, SVVARG(name));
+    if(verbose){
+        logf("Type %s value range is ", TYPE_TO_STR[type]);
+        switch(type){
+            case TYPE_I8:
+                logf("[%d;%d]\n", INT8_MIN, INT8_MAX);
+                break;
+            case TYPE_I32:
+                logf("[%d;%d]\n", INT32_MIN, INT32_MAX);
+                break;
+            case TYPE_I64:
+                logf("[%zu;%zu]\n", INT64_MIN, INT64_MAX);
+                break;
+            default:break;
+        }
+    }
+    exit(1);
+}
+
+// Cast int to variable
+void var_cast(Variable *var, CBReturn src){
+    // Type checking
+    // * mostly, assignation occurs on result of evaluate_expr function, which MUST calculate type of expression
+    // * if expression is numeric, that it can be assigned to anything that is not overflow or underflowed
+    if(src.type != var->type && src.type!=TYPE_NUMERIC){
+        type_mismatch_error(global_location, var->type, var->name, src.type);
+    }
+    if(src.num<TYPE_MIN[var->type] || src.num>TYPE_MAX[var->type]){
+        range_error(var->type, var->name, src.num);
+    }
+    if(var->type == TYPE_STRING){
+        var->ptr = src.string.data;
+        var->size = src.string.size;
+        return;
+    }
+    if(var->modifyer != MOD_PTR){
+        var->num = src.num;
+        return;
+    }
+    switch(var->type){
+        case TYPE_I8:
+            *(int8_t*)var->ptr = src.num;
+            break;
+        case TYPE_I32:
+            *(int32_t*)var->ptr = src.num;
+            break;
+        case TYPE_I64:
+            *(ssize_t*)var->ptr = src.num;
+            break;
+        default:
+           logf("ERROR: i8 i32 i64 and string types supported for assignement\n");
+           printloc(global_location);
+           exit(1);
+    }
+}
+
+// Items of string arrays are bytes
+size_t array_bytes(Variable arr){
+    return (arr.type == TYPE_STRING) ? arr.size : arr.size*get_type_size_in_bytes(arr.type);
+}
+
+void copy_array(Variable dst, Variable src){
+    if(dst.type!=src.type){
+        logf("ERROR: array copying types mismatch\n");
+        logf("tried assigning %s[%zd] to %s[%zd]\n", TYPE_TO_STR[src.type], src.size, TYPE_TO_STR[dst.type], dst.size);
+        exit(1);
+    }
+    memcpy(dst.ptr, src.ptr, array_bytes(src));
+}
+
+// 'dst = src;' for arrays of same type, checked by resolver, lengths have to match
+void assign_array(Variable dst, Variable src, Location loc){
+    if(dst.size != src.size){
+        printloc(loc);
+        logf(" Error: assigning %s[%zu] to %s[%zu], lengths differ\n",
+                TYPE_TO_STR[src.type], src.size, TYPE_TO_STR[dst.type], dst.size);
+        exit(1);
+    }
+    memmove(dst.ptr, src.ptr, array_bytes(src));
+}
+
+// Array descriptor and items in one block, freed with free()
+Variable *new_array(enum TypeEnum type, ssize_t size, SView name){
+    ssize_t item_size = get_type_size_in_bytes(type);
+    Variable *arr = calloc(1, sizeof(Variable) + item_size*size);
+    arr->name     = name;
+    arr->type     = type;
+    arr->modifyer = MOD_ARRAY;
+    arr->size     = size;
+    arr->ptr      = arr+1;
+    return arr;
+}
+
+ssize_t get_num_value(Variable var, Location loc){
+    if(var.modifyer != MOD_PTR && var.type != TYPE_NOT_A_TYPE){
+        return var.num;
+    }
+    ssize_t value = 0;
+    switch(var.type){
+        case TYPE_I8:
+            value = *(int8_t*)var.ptr;
+            break;
+        case TYPE_I32:
+            value = *(int32_t*)var.ptr;
+            break;
+        case TYPE_I64:
+            value = *(ssize_t*)var.ptr;
+            break;
+        case TYPE_NOT_A_TYPE:
+            printloc(loc);
+            logf(" Error: could not find variable!!!\n");
+            exit(1);
+            break;
+        default:
+           logf("EROR: i8 i32 i64 types supported for get_num_value\n");
+           exit(1);
+    }
+    return value;
+}
+ssize_t get_arr_num_value(Variable var, size_t index){
+    ssize_t value = 0;
+    switch(var.type){
+        case TYPE_I8:
+            value = *((int8_t*)var.ptr+index);
+            break;
+        case TYPE_I32:
+            value = *((int32_t*)var.ptr+index);
+            break;
+        case TYPE_I64:
+            value = *((ssize_t*)var.ptr+index);
+            break;
+        default:
+           logf("EROR: i8 i32 i64 types supported for get_num_value\n");
+           exit(1);
+    }
+    return value;
+}
+// Every array read and write goes through it, unless optimizer proved index in range
+void check_index(Variable arr, ssize_t index, Location loc){
+    if(index >= (ssize_t)arr.size || index < 0){
+        printloc(loc);
+        logf(" Error: array index %zd is out of range [0;%zd)\n", index, arr.size);
+        exit(69);
+    }
+}
+
+Variable get_var_from_arr(Variable arr_var, ssize_t arr_index){
+    void *arr_id_ptr=NULL;
+    switch(arr_var.type){
+        case TYPE_I8:
+            arr_id_ptr = (int8_t*)arr_var.ptr+arr_index;
+            break;
+        case TYPE_I32:
+            arr_id_ptr = (int32_t*)arr_var.ptr+arr_index;
+            break;
+        case TYPE_I64:
+            arr_id_ptr = (ssize_t*)arr_var.ptr+arr_index;
+            break;
+        default:
+            break;
+    }
+    Variable var = (Variable){.name = arr_var.name, .modifyer = MOD_PTR, .type = arr_var.type, .ptr = arr_id_ptr};
+    return var;
+}
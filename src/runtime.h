@@ -0,0 +1,166 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <ctype.h>
+#include <sys/types.h>
+
+// Runtime shared by the interpreter and programs built from --emit-c
+// output: values, arrays, std functions and their error messages. It is
+// self-contained, --emit-c copies it with runtime.c, simd.c and
+// cbrstdlib.c into every generated program.
+
+#ifndef _RUNTIME_H
+#define _RUNTIME_H
+#define MAX(a,b) (a>b)?a:b
+#define SVCMP(sv, b) strncmp(b, sv.data, MAX(sv.size, strlen(b)))
+#define SVVARG(sv) (int)sv.size, sv.data
+// diagnostics go after program output still held in output buffer
+#define logf(...) (out_flush(), printf(__VA_ARGS__))
+#define GLOBALERROR(error) { \
+    printloc(global_location); \
+    printf(error"\n"); \
+    exit(1); \
+}
+enum TypeEnum {
+    TYPE_NOT_A_TYPE,
+    TYPE_NUMERIC,
+    TYPE_STRING,
+    TYPE_VOID,
+    TYPE_I8,
+    TYPE_I32,
+    TYPE_I64,
+    TYPE_U8,
+    TYPE_U32,
+    TYPE_U64,
+};
+
+char *TYPE_TO_STR[]={
+    [TYPE_NOT_A_TYPE] = "NOT A TYPE",
+    [TYPE_VOID   ] = "void",
+    [TYPE_I8     ] = "i8",
+    [TYPE_I32    ] = "i32",
+    [TYPE_I64    ] = "i64",
+    [TYPE_STRING ] = "string"
+};
+
+// Value range of every type, assignation out of it is an error
+ssize_t TYPE_MIN[] = {
+    [TYPE_NOT_A_TYPE] = INT64_MIN, [TYPE_NUMERIC] = INT64_MIN,
+    [TYPE_STRING    ] = INT64_MIN, [TYPE_VOID   ] = INT64_MIN,
+    [TYPE_I8        ] = INT8_MIN,  [TYPE_I32    ] = INT32_MIN,
+    [TYPE_I64       ] = INT64_MIN, [TYPE_U8     ] = INT64_MIN,
+    [TYPE_U32       ] = INT64_MIN, [TYPE_U64    ] = INT64_MIN,
+};
+ssize_t TYPE_MAX[] = {
+    [TYPE_NOT_A_TYPE] = INT64_MAX, [TYPE_NUMERIC] = INT64_MAX,
+    [TYPE_STRING    ] = INT64_MAX, [TYPE_VOID   ] = INT64_MAX,
+    [TYPE_I8        ] = INT8_MAX,  [TYPE_I32    ] = INT32_MAX,
+    [TYPE_I64       ] = INT64_MAX, [TYPE_U8     ] = INT64_MAX,
+    [TYPE_U32       ] = INT64_MAX, [TYPE_U64    ] = INT64_MAX,
+};
+typedef struct {
+    char *data;
+    size_t size;
+} SView;
+enum FlowEnum {
+    FLOW_NEXT,
+    FLOW_BREAK,
+    FLOW_CONTINUE
+};
+
+typedef struct {
+    bool returned;
+    struct Func *tail_call;          // function to run in place of returning one
+    enum FlowEnum flow;
+    enum TypeEnum type;
+    union {
+        ssize_t num;
+        SView string;
+    };
+} CBReturn;
+
+enum ModifyerEnum {
+    MOD_NO_MOD,
+    MOD_PTR,
+    MOD_ARRAY
+};
+
+typedef struct {
+    char *file_path;
+    size_t row;
+    size_t col;
+} Location;
+
+// Scalars are stored inline in num, arrays and strings point to their data,
+// MOD_PTR variables are views of a scalar stored elsewhere (array item)
+typedef struct {
+    SView name;
+    enum TypeEnum type;
+    union {
+        void *ptr;
+        ssize_t num;
+    };
+    enum ModifyerEnum modifyer;
+    size_t size;
+} Variable;
+
+// Register VM value: scalars inline, arrays and strings by descriptor
+typedef union {
+    ssize_t num;
+    Variable *ref;
+} Value;
+
+// Native handler of std function, bound to std calls at load time
+typedef CBReturn (*StdFunction)(Variable *args, size_t argc);
+
+typedef struct {
+    char *name;
+    StdFunction fn;
+} StdEntry;
+
+enum SimdLevel {
+    SIMD_SCALAR,
+    SIMD_SSE2,
+    SIMD_AVX2
+};
+
+// Program output collects here, written out when full, before reading
+// stdin, before sleeping and at exit
+#define OUT_CAP 65536
+typedef struct {
+    char data[OUT_CAP];
+    size_t size;
+} OutBuffer;
+
+extern Location global_location;
+extern bool verbose;
+extern bool unbuffered;
+void out_flush(void);
+void printloc(Location loc);
+ssize_t get_type_size_in_bytes(enum TypeEnum type);
+void type_mismatch_error(Location loc, enum TypeEnum type, SView name, enum TypeEnum src_type);
+void range_error(enum TypeEnum type, SView name, ssize_t value);
+void var_cast(Variable *var, CBReturn src);
+size_t array_bytes(Variable arr);
+void copy_array(Variable dst, Variable src);
+void assign_array(Variable dst, Variable src, Location loc);
+Variable *new_array(enum TypeEnum type, ssize_t size, SView name);
+ssize_t get_num_value(Variable var, Location loc);
+ssize_t get_arr_num_value(Variable var, size_t index);
+void check_index(Variable arr, ssize_t index, Location loc);
+Variable get_var_from_arr(Variable arr_var, ssize_t arr_index);
+StdFunction find_stdcall(SView name);
+bool stdcall_writes_args(StdFunction fn);
+void setup_cbrstd(void);
+void setup_simd(enum SimdLevel max_level);
+ssize_t array_sum(Variable arr, bool *overflow);
+ssize_t array_min(Variable arr);
+ssize_t array_max(Variable arr);
+size_t array_count(Variable arr, ssize_t value);
+void array_fill(Variable arr, ssize_t value);
+ssize_t array_dot(Variable a, Variable b, bool *overflow);
+#endif
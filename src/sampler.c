@@ -0,0 +1,179 @@
+#ifndef _WIN32
+#include <signal.h>
+#include <sys/time.h>
+#endif
+#include "types.h"
+#include "functions.h"
+
+// --sample-profile=<hz>: a profiling timer interrupts the program hz times
+// per second of cpu time and counts the shadow stack of user calls it
+// finds. At exit every sampled stack is printed to stderr in the folded
+// format flame graph tools read, one 'main:12;fib:7;fib 42' per line.
+// Frames carry the line that called the next one. Running code only
+// pushes and pops frames, sampling is left to the signal.
+
+bool sampling = false;
+CallStack call_stack = {0};
+
+#ifndef _WIN32
+// One sample adds at most a node per frame, pushes below the limit leave
+// room for that. The handler lowers it as it takes nodes.
+void sample_update_limit(void){
+    size_t free_nodes = call_stack.node_cap - call_stack.nodec;
+    size_t limit = free_nodes > 1 ? free_nodes - 1 : 0;
+    call_stack.push_limit = limit < call_stack.frame_cap ? limit : call_stack.frame_cap;
+}
+
+// Pool and frames are reallocated with the signal blocked, so the handler
+// never sees them move.
+void sample_grow(void){
+    sigset_t block, old;
+    sigemptyset(&block);
+    sigaddset(&block, SIGPROF);
+    sigprocmask(SIG_BLOCK, &block, &old);
+    if(call_stack.framec == call_stack.frame_cap){
+        call_stack.frame_cap = call_stack.frame_cap ? call_stack.frame_cap*2 : 64;
+        call_stack.frames = realloc((CallFrame*)call_stack.frames, sizeof(CallFrame)*call_stack.frame_cap);
+    }
+    while(call_stack.nodec + call_stack.framec + 1 >= call_stack.node_cap){
+        call_stack.node_cap *= 2;
+        call_stack.nodes = realloc(call_stack.nodes, sizeof(CallNode)*call_stack.node_cap);
+    }
+    sample_update_limit();
+    sigprocmask(SIG_SETMASK, &old, NULL);
+}
+
+void sample_push(Func *fn, size_t row){
+    if(call_stack.framec >= call_stack.push_limit){
+        sample_grow();
+    }
+    call_stack.frames[call_stack.framec].fn  = fn;
+    call_stack.frames[call_stack.framec].row = row;
+    call_stack.framec++;
+}
+
+void sample_pop(void){
+    call_stack.framec--;
+}
+
+void sample_signal(int sig){
+    (void)sig;
+    CallNode *nodes = call_stack.nodes;
+    size_t framec = call_stack.framec;
+    size_t node = 0;
+    for(size_t i=0; i<framec; i++){
+        Func *fn = call_stack.frames[i].fn;
+        size_t row = call_stack.frames[i].row;
+        size_t child = nodes[node].child;
+        while(child && (nodes[child].fn != fn || nodes[child].row != row)){
+            child = nodes[child].next;
+        }
+        if(child == 0){
+            if(call_stack.nodec == call_stack.node_cap){
+                call_stack.dropped++;
+                sample_update_limit();
+                return;
+            }
+            child = call_stack.nodec++;
+            nodes[child] = (CallNode){
+                .fn = fn, .row = row, .parent = node, .next = nodes[node].child
+            };
+            nodes[node].child = child;
+        }
+        node = child;
+    }
+    nodes[node].samples++;
+    sample_update_limit();
+}
+
+void print_sampled_stack(size_t *path, size_t depth, size_t samples){
+    for(size_t i=0; i<depth; i++){
+        CallNode *node = &call_stack.nodes[path[i]];
+        fprintf(stderr, "%s%.*s", i ? ";" : "", SVVARG(node->fn->name));
+        if(i+1 < depth){
+            fprintf(stderr, ":%zu", call_stack.nodes[path[i+1]].row);
+        }
+    }
+    fprintf(stderr, " %zu\n", samples);
+}
+
+// Runs before functions are freed or at exit after runtime errors, and
+// walks the call tree without recursion.
+void sample_report(void){
+    if(call_stack.nodes == NULL){
+        return;
+    }
+    setitimer(ITIMER_PROF, &(struct itimerval){0}, NULL);
+    signal(SIGPROF, SIG_IGN);
+    CallNode *nodes = call_stack.nodes;
+    if(nodes[0].samples){
+        fprintf(stderr, "[interpreter] %zu\n", nodes[0].samples);
+    }
+    size_t *path = NULL;
+    size_t depth = 0, path_cap = 0;
+    size_t node = nodes[0].child;
+    while(node){
+        if(depth == path_cap){
+            path_cap = path_cap ? path_cap*2 : 64;
+            path = realloc(path, sizeof(size_t)*path_cap);
+        }
+        path[depth++] = node;
+        if(nodes[node].samples){
+            print_sampled_stack(path, depth, nodes[node].samples);
+        }
+        if(nodes[node].child){
+            node = nodes[node].child;
+            continue;
+        }
+        while(node && !nodes[node].next){
+            node = nodes[node].parent;
+            depth--;
+        }
+        if(node){
+            node = nodes[node].next;
+            depth--;
+        }
+    }
+    if(call_stack.dropped){
+        fprintf(stderr, "[dropped] %zu\n", call_stack.dropped);
+    }
+    free(path);
+    free(call_stack.nodes);
+    free((CallFrame*)call_stack.frames);
+    call_stack.nodes = NULL;
+    sampling = false;
+}
+
+void setup_sampler(long hz){
+    sampling = true;
+    call_stack.node_cap = 1024;
+    call_stack.nodes = calloc(call_stack.node_cap, sizeof(CallNode));
+    call_stack.nodec = 1; // root, time outside of user functions
+    atexit(sample_report);
+    struct sigaction action = {0};
+    action.sa_handler = sample_signal;
+    action.sa_flags = SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGPROF, &action, NULL);
+    long usec = 1000000 / hz;
+    struct itimerval timer = {
+        .it_interval = {.tv_sec = usec / 1000000, .tv_usec = usec % 1000000},
+        .it_value    = {.tv_sec = usec / 1000000, .tv_usec = usec % 1000000},
+    };
+    setitimer(ITIMER_PROF, &timer, NULL);
+}
+#else
+void sample_push(Func *fn, size_t row){
+    (void)fn;
+    (void)row;
+}
+
+void sample_pop(void){
+}
+
+void setup_sampler(long hz){
+    (void)hz;
+    logf("Error: --sample-profile needs a profiling timer, not available on Windows\n");
+    exit(1);
+}
+#endif
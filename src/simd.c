@@ -0,0 +1,458 @@
+#include "runtime.h"
+
+// Array kernels behind std.sum, std.min, std.max, std.count, std.fill and
+// std.dot. Every kernel has a scalar version, x86-64 also gets SSE2 and AVX2
+// versions picked once at startup by CPU support. Where an instruction set
+// has no fitting instruction (64 bit compare and multiply in SSE2, 64 bit
+// multiply in AVX2) the previous level is used.
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#define SIMD_X86
+#include <immintrin.h>
+#define AVX2 __attribute__((target("avx2")))
+#endif
+
+enum SimdLevel simd_level = SIMD_SCALAR;
+
+char *SIMD_TO_STR[] = {
+    [SIMD_SCALAR] = "scalar",
+    [SIMD_SSE2  ] = "sse2",
+    [SIMD_AVX2  ] = "avx2",
+};
+
+// Picks best supported level, max_level caps it
+void setup_simd(enum SimdLevel max_level){
+    simd_level = SIMD_SCALAR;
+#ifdef SIMD_X86
+    __builtin_cpu_init();
+    simd_level = __builtin_cpu_supports("avx2") ? SIMD_AVX2 : SIMD_SSE2;
+#endif
+    if(simd_level > max_level){
+        simd_level = max_level;
+    }
+}
+
+// Sums count how many times they wrapped past the i64 range, the true sum
+// is sum + wraps*2^64. It fits i64 only when wraps ends at 0, so overflow
+// depends on the total alone and every level agrees on it.
+#define ADD_WRAPPING(sum, value, wraps) \
+    if(__builtin_add_overflow(sum, value, &sum)){ \
+        wraps += ((value) < 0) ? -1 : 1; \
+    }
+
+// Scalar kernels, also finish tails of vector loops
+#define SCALAR_KERNELS(T, name) \
+ssize_t sum_##name##_scalar(T *a, size_t n, ssize_t *wraps){ \
+    ssize_t sum = 0; \
+    for(size_t i = 0; i<n; i++){ \
+        ssize_t item = a[i]; \
+        ADD_WRAPPING(sum, item, *wraps); \
+    } \
+    return sum; \
+} \
+ssize_t min_##name##_scalar(T *a, size_t n){ \
+    T min = a[0]; \
+    for(size_t i = 1; i<n; i++){ \
+        min = (a[i] < min) ? a[i] : min; \
+    } \
+    return min; \
+} \
+ssize_t max_##name##_scalar(T *a, size_t n){ \
+    T max = a[0]; \
+    for(size_t i = 1; i<n; i++){ \
+        max = (a[i] > max) ? a[i] : max; \
+    } \
+    return max; \
+} \
+size_t count_##name##_scalar(T *a, size_t n, T value){ \
+    size_t count = 0; \
+    for(size_t i = 0; i<n; i++){ \
+        count += a[i] == value; \
+    } \
+    return count; \
+} \
+void fill_##name##_scalar(T *a, size_t n, T value){ \
+    for(size_t i = 0; i<n; i++){ \
+        a[i] = value; \
+    } \
+} \
+ssize_t dot_##name##_scalar(T *a, T *b, size_t n, ssize_t *wraps, bool *overflow){ \
+    ssize_t sum = 0; \
+    for(size_t i = 0; i<n; i++){ \
+        ssize_t product; \
+        *overflow |= __builtin_mul_overflow((ssize_t)a[i], (ssize_t)b[i], &product); \
+        ADD_WRAPPING(sum, product, *wraps); \
+    } \
+    return sum; \
+}
+SCALAR_KERNELS(int8_t,  i8)
+SCALAR_KERNELS(int32_t, i32)
+SCALAR_KERNELS(ssize_t, i64)
+
+// Lane sums are exact, they are added to the tail sum counting wraps
+ssize_t sum_lanes(ssize_t *lanes, size_t lanec, ssize_t sum, ssize_t *wraps){
+    for(size_t i = 0; i<lanec; i++){
+        ADD_WRAPPING(sum, lanes[i], *wraps);
+    }
+    return sum;
+}
+
+#ifdef SIMD_X86
+// 64 bit lane addition overflowed when result sign differs from both operands.
+// Lanes do not count wraps, kernels with a wrapped lane start over in order.
+#define ADD_EPI64_CHECKED(add, and, xor, or, acc, v, flags) { \
+    __typeof__(acc) sum_ = add(acc, v); \
+    flags = or(flags, and(xor(acc, sum_), xor(v, sum_))); \
+    acc = sum_; \
+}
+
+// SSE2 is part of x86-64, these need no dispatch guard
+ssize_t sum_i8_sse2(int8_t *a, size_t n, ssize_t *wraps){
+    // bytes biased to unsigned are summed by sad, bias is taken back at the end
+    __m128i bias = _mm_set1_epi8((char)0x80);
+    __m128i acc  = _mm_setzero_si128();
+    size_t i = 0;
+    for(; i+16<=n; i+=16){
+        __m128i v = _mm_xor_si128(_mm_loadu_si128((__m128i*)(a+i)), bias);
+        acc = _mm_add_epi64(acc, _mm_sad_epu8(v, _mm_setzero_si128()));
+    }
+    ssize_t lanes[2];
+    _mm_storeu_si128((__m128i*)lanes, acc);
+    ssize_t sum = lanes[0] + lanes[1] - 128*(ssize_t)i;
+    return sum + sum_i8_scalar(a+i, n-i, wraps);
+}
+
+ssize_t sum_i32_sse2(int32_t *a, size_t n, ssize_t *wraps){
+    __m128i acc = _mm_setzero_si128();
+    size_t i = 0;
+    for(; i+4<=n; i+=4){
+        __m128i v    = _mm_loadu_si128((__m128i*)(a+i));
+        __m128i sign = _mm_cmpgt_epi32(_mm_setzero_si128(), v);
+        acc = _mm_add_epi64(acc, _mm_unpacklo_epi32(v, sign));
+        acc = _mm_add_epi64(acc, _mm_unpackhi_epi32(v, sign));
+    }
+    ssize_t lanes[2];
+    _mm_storeu_si128((__m128i*)lanes, acc);
+    return sum_lanes(lanes, 2, sum_i32_scalar(a+i, n-i, wraps), wraps);
+}
+
+ssize_t sum_i64_sse2(ssize_t *a, size_t n, ssize_t *wraps){
+    __m128i acc   = _mm_setzero_si128();
+    __m128i flags = _mm_setzero_si128();
+    size_t i = 0;
+    for(; i+2<=n; i+=2){
+        __m128i v = _mm_loadu_si128((__m128i*)(a+i));
+        ADD_EPI64_CHECKED(_mm_add_epi64, _mm_and_si128, _mm_xor_si128, _mm_or_si128, acc, v, flags);
+    }
+    if(_mm_movemask_pd(_mm_castsi128_pd(flags)) != 0){
+        return sum_i64_scalar(a, n, wraps);
+    }
+    ssize_t lanes[2];
+    _mm_storeu_si128((__m128i*)lanes, acc);
+    return sum_lanes(lanes, 2, sum_i64_scalar(a+i, n-i, wraps), wraps);
+}
+
+// SSE2 has no signed min and max for bytes and ints, compare and select
+#define SSE2_SELECT(mask, a, b) _mm_or_si128(_mm_and_si128(mask, a), _mm_andnot_si128(mask, b))
+#define SSE2_MIN_I8(a, b)  SSE2_SELECT(_mm_cmpgt_epi8(a, b), b, a)
+#define SSE2_MAX_I8(a, b)  SSE2_SELECT(_mm_cmpgt_epi8(b, a), b, a)
+#define SSE2_MIN_I32(a, b) SSE2_SELECT(_mm_cmpgt_epi32(a, b), b, a)
+#define SSE2_MAX_I32(a, b) SSE2_SELECT(_mm_cmpgt_epi32(b, a), b, a)
+#define SSE2_REDUCE(T, name, lanec, op, vop) \
+ssize_t op##_##name##_sse2(T *a, size_t n){ \
+    if(n < lanec){ \
+        return op##_##name##_scalar(a, n); \
+    } \
+    __m128i acc = _mm_loadu_si128((__m128i*)a); \
+    for(size_t i = lanec; i+lanec<=n; i+=lanec){ \
+        acc = vop(acc, _mm_loadu_si128((__m128i*)(a+i))); \
+    } \
+    /* tail is covered by last full vector, items seen twice do not matter */ \
+    acc = vop(acc, _mm_loadu_si128((__m128i*)(a+n-lanec))); \
+    T lanes[lanec]; \
+    _mm_storeu_si128((__m128i*)lanes, acc); \
+    return op##_##name##_scalar(lanes, lanec); \
+}
+SSE2_REDUCE(int8_t,  i8,  16, min, SSE2_MIN_I8)
+SSE2_REDUCE(int8_t,  i8,  16, max, SSE2_MAX_I8)
+SSE2_REDUCE(int32_t, i32, 4,  min, SSE2_MIN_I32)
+SSE2_REDUCE(int32_t, i32, 4,  max, SSE2_MAX_I32)
+#define min_i64_sse2 min_i64_scalar
+#define max_i64_sse2 max_i64_scalar
+
+size_t count_i8_sse2(int8_t *a, size_t n, int8_t value){
+    __m128i needle = _mm_set1_epi8(value);
+    size_t count = 0, i = 0;
+    for(; i+16<=n; i+=16){
+        __m128i eq = _mm_cmpeq_epi8(_mm_loadu_si128((__m128i*)(a+i)), needle);
+        count += __builtin_popcount(_mm_movemask_epi8(eq));
+    }
+    return count + count_i8_scalar(a+i, n-i, value);
+}
+
+size_t count_i32_sse2(int32_t *a, size_t n, int32_t value){
+    __m128i needle = _mm_set1_epi32(value);
+    size_t count = 0, i = 0;
+    for(; i+4<=n; i+=4){
+        __m128i eq = _mm_cmpeq_epi32(_mm_loadu_si128((__m128i*)(a+i)), needle);
+        count += __builtin_popcount(_mm_movemask_ps(_mm_castsi128_ps(eq)));
+    }
+    return count + count_i32_scalar(a+i, n-i, value);
+}
+
+size_t count_i64_sse2(ssize_t *a, size_t n, ssize_t value){
+    __m128i needle = _mm_set1_epi64x(value);
+    size_t count = 0, i = 0;
+    for(; i+2<=n; i+=2){
+        // both halves equal, swapped halves are and-ed into each other
+        __m128i eq = _mm_cmpeq_epi32(_mm_loadu_si128((__m128i*)(a+i)), needle);
+        eq = _mm_and_si128(eq, _mm_shuffle_epi32(eq, _MM_SHUFFLE(2, 3, 0, 1)));
+        count += __builtin_popcount(_mm_movemask_pd(_mm_castsi128_pd(eq)));
+    }
+    return count + count_i64_scalar(a+i, n-i, value);
+}
+
+#define SSE2_FILL(T, name, lanec, set1) \
+void fill_##name##_sse2(T *a, size_t n, T value){ \
+    __m128i v = set1(value); \
+    size_t i = 0; \
+    for(; i+lanec<=n; i+=lanec){ \
+        _mm_storeu_si128((__m128i*)(a+i), v); \
+    } \
+    fill_##name##_scalar(a+i, n-i, value); \
+}
+SSE2_FILL(int8_t,  i8,  16, _mm_set1_epi8)
+SSE2_FILL(int32_t, i32, 4,  _mm_set1_epi32)
+SSE2_FILL(ssize_t, i64, 2,  _mm_set1_epi64x)
+
+ssize_t dot_i8_sse2(int8_t *a, int8_t *b, size_t n, ssize_t *wraps, bool *overflow){
+    // bytes widened to shorts, madd sums product pairs into ints
+    __m128i acc = _mm_setzero_si128();
+    __m128i zero = _mm_setzero_si128();
+    size_t i = 0;
+    for(; i+16<=n; i+=16){
+        __m128i va = _mm_loadu_si128((__m128i*)(a+i));
+        __m128i vb = _mm_loadu_si128((__m128i*)(b+i));
+        __m128i sa = _mm_cmpgt_epi8(zero, va);
+        __m128i sb = _mm_cmpgt_epi8(zero, vb);
+        __m128i p = _mm_add_epi32(
+                _mm_madd_epi16(_mm_unpacklo_epi8(va, sa), _mm_unpacklo_epi8(vb, sb)),
+                _mm_madd_epi16(_mm_unpackhi_epi8(va, sa), _mm_unpackhi_epi8(vb, sb)));
+        __m128i sp = _mm_cmpgt_epi32(zero, p);
+        acc = _mm_add_epi64(acc, _mm_unpacklo_epi32(p, sp));
+        acc = _mm_add_epi64(acc, _mm_unpackhi_epi32(p, sp));
+    }
+    ssize_t lanes[2];
+    _mm_storeu_si128((__m128i*)lanes, acc);
+    return sum_lanes(lanes, 2, dot_i8_scalar(a+i, b+i, n-i, wraps, overflow), wraps);
+}
+#define dot_i32_sse2 dot_i32_scalar
+#define dot_i64_sse2 dot_i64_scalar
+
+AVX2 ssize_t sum_i8_avx2(int8_t *a, size_t n, ssize_t *wraps){
+    __m256i bias = _mm256_set1_epi8((char)0x80);
+    __m256i acc  = _mm256_setzero_si256();
+    size_t i = 0;
+    for(; i+32<=n; i+=32){
+        __m256i v = _mm256_xor_si256(_mm256_loadu_si256((__m256i*)(a+i)), bias);
+        acc = _mm256_add_epi64(acc, _mm256_sad_epu8(v, _mm256_setzero_si256()));
+    }
+    ssize_t lanes[4];
+    _mm256_storeu_si256((__m256i*)lanes, acc);
+    ssize_t sum = lanes[0] + lanes[1] + lanes[2] + lanes[3] - 128*(ssize_t)i;
+    return sum + sum_i8_scalar(a+i, n-i, wraps);
+}
+
+AVX2 ssize_t sum_i32_avx2(int32_t *a, size_t n, ssize_t *wraps){
+    __m256i acc0 = _mm256_setzero_si256();
+    __m256i acc1 = _mm256_setzero_si256();
+    size_t i = 0;
+    for(; i+8<=n; i+=8){
+        acc0 = _mm256_add_epi64(acc0, _mm256_cvtepi32_epi64(_mm_loadu_si128((__m128i*)(a+i))));
+        acc1 = _mm256_add_epi64(acc1, _mm256_cvtepi32_epi64(_mm_loadu_si128((__m128i*)(a+i+4))));
+    }
+    ssize_t lanes[8];
+    _mm256_storeu_si256((__m256i*)lanes, acc0);
+    _mm256_storeu_si256((__m256i*)(lanes+4), acc1);
+    return sum_lanes(lanes, 8, sum_i32_scalar(a+i, n-i, wraps), wraps);
+}
+
+AVX2 ssize_t sum_i64_avx2(ssize_t *a, size_t n, ssize_t *wraps){
+    __m256i acc   = _mm256_setzero_si256();
+    __m256i flags = _mm256_setzero_si256();
+    size_t i = 0;
+    for(; i+4<=n; i+=4){
+        __m256i v = _mm256_loadu_si256((__m256i*)(a+i));
+        ADD_EPI64_CHECKED(_mm256_add_epi64, _mm256_and_si256, _mm256_xor_si256, _mm256_or_si256, acc, v, flags);
+    }
+    if(_mm256_movemask_pd(_mm256_castsi256_pd(flags)) != 0){
+        return sum_i64_scalar(a, n, wraps);
+    }
+    ssize_t lanes[4];
+    _mm256_storeu_si256((__m256i*)lanes, acc);
+    return sum_lanes(lanes, 4, sum_i64_scalar(a+i, n-i, wraps), wraps);
+}
+
+// 64 bit min and max are compare and blend, smaller types have instructions
+#define AVX2_MIN_I64(a, b) _mm256_blendv_epi8(a, b, _mm256_cmpgt_epi64(a, b))
+#define AVX2_MAX_I64(a, b) _mm256_blendv_epi8(a, b, _mm256_cmpgt_epi64(b, a))
+#define AVX2_REDUCE(T, name, lanec, op, vop) \
+AVX2 ssize_t op##_##name##_avx2(T *a, size_t n){ \
+    if(n < lanec){ \
+        return op##_##name##_scalar(a, n); \
+    } \
+    __m256i acc = _mm256_loadu_si256((__m256i*)a); \
+    for(size_t i = lanec; i+lanec<=n; i+=lanec){ \
+        acc = vop(acc, _mm256_loadu_si256((__m256i*)(a+i))); \
+    } \
+    /* tail is covered by last full vector, items seen twice do not matter */ \
+    acc = vop(acc, _mm256_loadu_si256((__m256i*)(a+n-lanec))); \
+    T lanes[lanec]; \
+    _mm256_storeu_si256((__m256i*)lanes, acc); \
+    return op##_##name##_scalar(lanes, lanec); \
+}
+AVX2_REDUCE(int8_t,  i8,  32, min, _mm256_min_epi8)
+AVX2_REDUCE(int8_t,  i8,  32, max, _mm256_max_epi8)
+AVX2_REDUCE(int32_t, i32, 8,  min, _mm256_min_epi32)
+AVX2_REDUCE(int32_t, i32, 8,  max, _mm256_max_epi32)
+AVX2_REDUCE(ssize_t, i64, 4,  min, AVX2_MIN_I64)
+AVX2_REDUCE(ssize_t, i64, 4,  max, AVX2_MAX_I64)
+
+AVX2 size_t count_i8_avx2(int8_t *a, size_t n, int8_t value){
+    __m256i needle = _mm256_set1_epi8(value);
+    size_t count = 0, i = 0;
+    for(; i+32<=n; i+=32){
+        __m256i eq = _mm256_cmpeq_epi8(_mm256_loadu_si256((__m256i*)(a+i)), needle);
+        count += __builtin_popcount((unsigned)_mm256_movemask_epi8(eq));
+    }
+    return count + count_i8_scalar(a+i, n-i, value);
+}
+
+AVX2 size_t count_i32_avx2(int32_t *a, size_t n, int32_t value){
+    __m256i needle = _mm256_set1_epi32(value);
+    size_t count = 0, i = 0;
+    for(; i+8<=n; i+=8){
+        __m256i eq = _mm256_cmpeq_epi32(_mm256_loadu_si256((__m256i*)(a+i)), needle);
+        count += __builtin_popcount(_mm256_movemask_ps(_mm256_castsi256_ps(eq)));
+    }
+    return count + count_i32_scalar(a+i, n-i, value);
+}
+
+AVX2 size_t count_i64_avx2(ssize_t *a, size_t n, ssize_t value){
+    __m256i needle = _mm256_set1_epi64x(value);
+    size_t count = 0, i = 0;
+    for(; i+4<=n; i+=4){
+        __m256i eq = _mm256_cmpeq_epi64(_mm256_loadu_si256((__m256i*)(a+i)), needle);
+        count += __builtin_popcount(_mm256_movemask_pd(_mm256_castsi256_pd(eq)));
+    }
+    return count + count_i64_scalar(a+i, n-i, value);
+}
+
+#define AVX2_FILL(T, name, lanec, set1) \
+AVX2 void fill_##name##_avx2(T *a, size_t n, T value){ \
+    __m256i v = set1(value); \
+    size_t i = 0; \
+    for(; i+lanec<=n; i+=lanec){ \
+        _mm256_storeu_si256((__m256i*)(a+i), v); \
+    } \
+    fill_##name##_scalar(a+i, n-i, value); \
+}
+AVX2_FILL(int8_t,  i8,  32, _mm256_set1_epi8)
+AVX2_FILL(int32_t, i32, 8,  _mm256_set1_epi32)
+AVX2_FILL(ssize_t, i64, 4,  _mm256_set1_epi64x)
+
+AVX2 ssize_t dot_i8_avx2(int8_t *a, int8_t *b, size_t n, ssize_t *wraps, bool *overflow){
+    __m256i acc = _mm256_setzero_si256();
+    size_t i = 0;
+    for(; i+16<=n; i+=16){
+        __m256i va = _mm256_cvtepi8_epi16(_mm_loadu_si128((__m128i*)(a+i)));
+        __m256i vb = _mm256_cvtepi8_epi16(_mm_loadu_si128((__m128i*)(b+i)));
+        __m256i p  = _mm256_madd_epi16(va, vb);
+        acc = _mm256_add_epi64(acc, _mm256_cvtepi32_epi64(_mm256_castsi256_si128(p)));
+        acc = _mm256_add_epi64(acc, _mm256_cvtepi32_epi64(_mm256_extracti128_si256(p, 1)));
+    }
+    ssize_t lanes[4];
+    _mm256_storeu_si256((__m256i*)lanes, acc);
+    return sum_lanes(lanes, 4, dot_i8_scalar(a+i, b+i, n-i, wraps, overflow), wraps);
+}
+
+AVX2 ssize_t dot_i32_avx2(int32_t *a, int32_t *b, size_t n, ssize_t *wraps, bool *overflow){
+    // ints widened to 64 bit lanes, mul_epi32 takes signed low halves
+    __m256i acc   = _mm256_setzero_si256();
+    __m256i flags = _mm256_setzero_si256();
+    size_t i = 0;
+    for(; i+4<=n; i+=4){
+        __m256i va = _mm256_cvtepi32_epi64(_mm_loadu_si128((__m128i*)(a+i)));
+        __m256i vb = _mm256_cvtepi32_epi64(_mm_loadu_si128((__m128i*)(b+i)));
+        __m256i p  = _mm256_mul_epi32(va, vb);
+        ADD_EPI64_CHECKED(_mm256_add_epi64, _mm256_and_si256, _mm256_xor_si256, _mm256_or_si256, acc, p, flags);
+    }
+    if(_mm256_movemask_pd(_mm256_castsi256_pd(flags)) != 0){
+        return dot_i32_scalar(a, b, n, wraps, overflow);
+    }
+    ssize_t lanes[4];
+    _mm256_storeu_si256((__m256i*)lanes, acc);
+    return sum_lanes(lanes, 4, dot_i32_scalar(a+i, b+i, n-i, wraps, overflow), wraps);
+}
+#define dot_i64_avx2 dot_i64_scalar
+
+#define SIMD_PICK(kernel) \
+    ((simd_level == SIMD_AVX2) ? kernel##_avx2 : (simd_level == SIMD_SSE2) ? kernel##_sse2 : kernel##_scalar)
+#else
+#define SIMD_PICK(kernel) kernel##_scalar
+#endif
+
+// Dispatchers take number arrays, callers check element type
+#define SIMD_BY_TYPE(type, kernel, ...) \
+    switch(type){ \
+        case TYPE_I8:  return SIMD_PICK(kernel##_i8)(__VA_ARGS__); \
+        case TYPE_I32: return SIMD_PICK(kernel##_i32)(__VA_ARGS__); \
+        default:       return SIMD_PICK(kernel##_i64)(__VA_ARGS__); \
+    }
+
+ssize_t sum_by_type(Variable arr, ssize_t *wraps){
+    SIMD_BY_TYPE(arr.type, sum, arr.ptr, arr.size, wraps);
+}
+
+// overflow is set when the sum of all items does not fit i64
+ssize_t array_sum(Variable arr, bool *overflow){
+    ssize_t wraps = 0;
+    ssize_t sum = sum_by_type(arr, &wraps);
+    *overflow = wraps != 0;
+    return sum;
+}
+
+// arr.size has to be checked to be at least 1
+ssize_t array_min(Variable arr){
+    SIMD_BY_TYPE(arr.type, min, arr.ptr, arr.size);
+}
+
+ssize_t array_max(Variable arr){
+    SIMD_BY_TYPE(arr.type, max, arr.ptr, arr.size);
+}
+
+// value has to fit element type
+size_t array_count(Variable arr, ssize_t value){
+    SIMD_BY_TYPE(arr.type, count, arr.ptr, arr.size, value);
+}
+
+void array_fill(Variable arr, ssize_t value){
+    switch(arr.type){
+        case TYPE_I8:  SIMD_PICK(fill_i8)(arr.ptr, arr.size, value);  break;
+        case TYPE_I32: SIMD_PICK(fill_i32)(arr.ptr, arr.size, value); break;
+        default:       SIMD_PICK(fill_i64)(arr.ptr, arr.size, value); break;
+    }
+}
+
+ssize_t dot_by_type(Variable a, Variable b, ssize_t *wraps, bool *overflow){
+    SIMD_BY_TYPE(a.type, dot, a.ptr, b.ptr, a.size, wraps, overflow);
+}
+
+// a and b have to be of same type and size, overflow is set when a product
+// or the sum of all products does not fit i64
+ssize_t array_dot(Variable a, Variable b, bool *overflow){
+    ssize_t wraps = 0;
+    ssize_t dot = dot_by_type(a, b, &wraps, overflow);
+    *overflow |= wraps != 0;
+    return dot;
+}
@@ -0,0 +1,114 @@
+#include "types.h"
+#include "functions.h"
+
+// --stats: counts what drives interpreter cost and prints it as JSON to
+// stderr at exit. Counts are deterministic, so runs of two interpreter
+// versions can be diffed. With --stats allocations keep their requested
+// size in a header, so bytes do not depend on the allocator or platform.
+// print_stats is set before the first allocation and never changes, so
+// every block is freed the way it was allocated. Parenthesized names below
+// call the allocator itself, not the counting macros from types.h.
+
+bool print_stats = false;
+Stats stats = {0};
+
+void *count_alloc(AllocStats *counter, AllocHeader *header, size_t size){
+    if(header == NULL){
+        return NULL;
+    }
+    header->size = size;
+    counter->count++;
+    counter->bytes += size;
+    stats.live.count++;
+    stats.live.bytes += size;
+    return header + 1;
+}
+
+void *stats_malloc(size_t size){
+    if(size > SIZE_MAX - sizeof(AllocHeader)){
+        return NULL;
+    }
+    return count_alloc(&stats.mallocs, (malloc)(sizeof(AllocHeader) + size), size);
+}
+
+void *stats_calloc(size_t count, size_t size){
+    if(size && count > (SIZE_MAX - sizeof(AllocHeader)) / size){
+        return NULL;
+    }
+    return count_alloc(&stats.callocs, (calloc)(1, sizeof(AllocHeader) + count*size), count*size);
+}
+
+void *stats_realloc(void *ptr, size_t size){
+    if(ptr == NULL){
+        return count_alloc(&stats.reallocs, (malloc)(sizeof(AllocHeader) + size), size);
+    }
+    if(size > SIZE_MAX - sizeof(AllocHeader)){
+        return NULL;
+    }
+    AllocHeader *header = (AllocHeader*)ptr - 1;
+    size_t old_size = header->size;
+    header = (realloc)(header, sizeof(AllocHeader) + size);
+    if(header == NULL){
+        return NULL;
+    }
+    header->size = size;
+    stats.reallocs.count++;
+    if(size > old_size){
+        stats.reallocs.bytes += size - old_size;
+    }
+    stats.live.bytes += size - old_size;
+    return header + 1;
+}
+
+void stats_free(void *ptr){
+    if(ptr == NULL){
+        return;
+    }
+    AllocHeader *header = (AllocHeader*)ptr - 1;
+    stats.frees.count++;
+    stats.frees.bytes += header->size;
+    stats.live.count--;
+    stats.live.bytes -= header->size;
+    (free)(header);
+}
+
+void print_alloc_stats(char *name, AllocStats counter, char *end){
+    fprintf(stderr, "    \"%s\": {\"count\": %zu, \"bytes\": %zu}%s\n", name, counter.count, counter.bytes, end);
+}
+
+// Runs at exit after everything main frees, live is what leaked
+void stats_report(void){
+    fprintf(stderr, "{\n");
+    fprintf(stderr, "  \"engine\": \"%s\",\n", tree_walk ? "tree-walk" : "vm");
+    fprintf(stderr, "  \"load\": {\n");
+    fprintf(stderr, "    \"name_lookups\": %zu,\n", stats.name_lookups);
+    fprintf(stderr, "    \"locals_scanned\": %zu,\n", stats.locals_scanned);
+    fprintf(stderr, "    \"locals_scanned_per_lookup\": %.2f,\n",
+            stats.name_lookups ? (double)stats.locals_scanned / stats.name_lookups : 0);
+    fprintf(stderr, "    \"instructions\": %zu\n", stats.instructions);
+    fprintf(stderr, "  },\n");
+    fprintf(stderr, "  \"run\": {\n");
+    fprintf(stderr, "    \"statements\": %zu,\n", stats.statements);
+    if(tree_walk){
+        fprintf(stderr, "    \"expr_evaluations\": %zu,\n", stats.expr_evaluations);
+    } else {
+        fprintf(stderr, "    \"expr_evaluations\": null,\n");
+    }
+    fprintf(stderr, "    \"user_calls\": %zu,\n", stats.user_calls);
+    fprintf(stderr, "    \"tail_calls\": %zu,\n", stats.tail_calls);
+    fprintf(stderr, "    \"std_calls\": %zu\n", stats.std_calls);
+    fprintf(stderr, "  },\n");
+    fprintf(stderr, "  \"memory\": {\n");
+    print_alloc_stats("malloc",  stats.mallocs,  ",");
+    print_alloc_stats("calloc",  stats.callocs,  ",");
+    print_alloc_stats("realloc", stats.reallocs, ",");
+    print_alloc_stats("free",    stats.frees,    ",");
+    print_alloc_stats("live_at_exit", stats.live, "");
+    fprintf(stderr, "  }\n");
+    fprintf(stderr, "}\n");
+}
+
+void setup_stats(void){
+    print_stats = true;
+    atexit(stats_report);
+}
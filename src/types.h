@@ -1,34 +1,26 @@
-#include <stdlib.h>
-#include <string.h>
-#include <errno.h>
-#include <stdbool.h>
-#include <stdint.h>
-#include <ctype.h>
+#include "runtime.h"
 
 #ifndef _TYPES_H
 #define _TYPES_H
 #define CURR this->source[this->pos]
-#define MAX(a,b) (a>b)?a:b
-#define SVCMP(sv, b) strncmp(b, sv.data, MAX(sv.size, strlen(b)))
 #define SVSVCMP(sv, b) strncmp(b.data, sv.data, MAX(sv.size, b.size))
-#define SVVARG(sv) (int)sv.size, sv.data
 #define SVTOL(sv) strtol(sv.data, NULL, 10)
-#define logf printf
-
-#define COLLECT_EXPR(bracketo, bracketc, expr, i){ \
-    exprc = 0; \
-    for(int depth_level=1; token.type!=bracketc && depth_level!=0;){ \
-        token = expr[++i]; \
-        exprc++; \
-        switch(token.type){ \
-            case bracketo:depth_level++;break; \
-            case bracketc:depth_level--;break; \
-            default:break; \
-        } \
-    } \
-}
+// --stats counts allocations of the interpreter, see stats.c. Without it
+// the allocator is called directly. Programs built from --emit-c output
+// always allocate directly.
+extern bool print_stats;
+void *stats_malloc(size_t size);
+void *stats_calloc(size_t count, size_t size);
+void *stats_realloc(void *ptr, size_t size);
+void stats_free(void *ptr);
+#define malloc(size) (print_stats ? stats_malloc(size) : malloc(size))
+#define calloc(count, size) (print_stats ? stats_calloc(count, size) : calloc(count, size))
+#define realloc(ptr, size) (print_stats ? stats_realloc(ptr, size) : realloc(ptr, size))
+#define free(ptr) (print_stats ? stats_free(ptr) : free(ptr))
+#define STD_MAX_ARGS 64
+
 #define TOKENERROR(error) { \
-    printf("\n"); \
+    logf("\n"); \
     printloc(token.loc); \
     printf(error "'%.*s'\n", SVVARG(token.sv)); \
     exit(1); \
@@ -38,40 +30,6 @@
     printf(error"\n"); \
     exit(1); \
 }
-enum TypeEnum {
-    TYPE_NOT_A_TYPE,
-    TYPE_NUMERIC,
-    TYPE_STRING,
-    TYPE_VOID,
-    TYPE_I8,
-    TYPE_I32,
-    TYPE_I64,
-    TYPE_U8,
-    TYPE_U32,
-    TYPE_U64,
-};
-
-char *TYPE_TO_STR[]={
-    [TYPE_NOT_A_TYPE] = "NOT A TYPE",
-    [TYPE_VOID   ] = "void",
-    [TYPE_I8     ] = "i8",
-    [TYPE_I32    ] = "i32",
-    [TYPE_I64    ] = "i64",
-    [TYPE_STRING ] = "string"
-};
-typedef struct {
-    char *data;
-    size_t size;
-} SView;
-typedef struct {
-    bool returned;
-    enum TypeEnum type;
-    union {
-        ssize_t num;
-        SView string;
-    };
-} CBReturn;
-
 enum TokenEnum {
     TOKEN_FN_DECL,
     TOKEN_NAME,
@@ -106,7 +64,10 @@ enum TokenEnum {
     TOKEN_DOT,
     TOKEN_TRUE,
     TOKEN_FALSE,
-    TOKEN_VOID
+    TOKEN_VOID,
+    TOKEN_TYPE,
+    TOKEN_STD,
+    TOKEN_EOF
 };
 
 char *TOKEN_TO_STR[] = {
@@ -136,18 +97,17 @@ char *TOKEN_TO_STR[] = {
     [TOKEN_ELSE         ] = "TOKEN_ELSE",
     [TOKEN_WHILE        ] = "TOKEN_WHILE",
     [TOKEN_FOR          ] = "TOKEN_FOR",
+    [TOKEN_CONTINUE     ] = "TOKEN_CONTINUE",
+    [TOKEN_BREAK        ] = "TOKEN_BREAK",
     [TOKEN_OSQUAR       ] = "TOKEN_OSQUAR",
     [TOKEN_CSQUAR       ] = "TOKEN_CSQUAR",
     [TOKEN_DOT          ] = "TOKEN_DOT",
     [TOKEN_TRUE         ] = "TOKEN_TRUE",
     [TOKEN_FALSE        ] = "TOKEN_FLASE",
-    [TOKEN_VOID         ] = "TOKEN_VOID"
-};
-
-enum ModifyerEnum {
-    MOD_NO_MOD,
-    MOD_PTR,
-    MOD_ARRAY
+    [TOKEN_VOID         ] = "TOKEN_VOID",
+    [TOKEN_TYPE         ] = "TOKEN_TYPE",
+    [TOKEN_STD          ] = "TOKEN_STD",
+    [TOKEN_EOF          ] = "TOKEN_EOF"
 };
 
 char *MOD_TO_STR[] = {
@@ -166,32 +126,20 @@ typedef struct {
     size_t bol;
 } Lexer;
 
-typedef struct {
-    char *file_path;
-    size_t row;
-    size_t col;
-} Location;
-
 typedef struct {
     enum TokenEnum type;
     SView sv;
     Location loc;
+    enum TypeEnum var_type; // type named by TOKEN_TYPE
 } Token;
 
 typedef struct {
     SView name;
     enum TypeEnum type;
     enum ModifyerEnum modifyer;
+    bool copy;           // array parameter is copied on call instead of borrowed
 } Var_signature;
 
-typedef struct {
-    SView name;
-    enum TypeEnum type;
-    void *ptr;
-    enum ModifyerEnum modifyer;
-    size_t size;
-} Variable;
-
 typedef struct {
     Variable *variables;
     size_t varc;
@@ -204,22 +152,547 @@ typedef struct {
 
 typedef struct {
     Token *code;
-    Variables *variables;
     size_t exprc;
-    int depth;
+    size_t *pairs;       // index of matching bracket for ( ) { } [ ] tokens
 } CodeBlock;
 
 typedef struct {
+    Token *tokens;
+    size_t count;
+    size_t pos;
+    size_t loop_depth;
+    size_t *pairs;
+} Parser;
+
+enum BinopEnum {
+    BINOP_NONE,
+    BINOP_ADD,
+    BINOP_SUB,
+    BINOP_MUL,
+    BINOP_DIV,
+    BINOP_MOD,
+    BINOP_LESS,
+    BINOP_LESS_EQ,
+    BINOP_GREATER,
+    BINOP_GREATER_EQ,
+    BINOP_EQ,
+    BINOP_NOT_EQ
+};
+
+char *BINOP_TO_STR[] = {
+    [BINOP_NONE      ] = "",
+    [BINOP_ADD       ] = "+",
+    [BINOP_SUB       ] = "-",
+    [BINOP_MUL       ] = "*",
+    [BINOP_DIV       ] = "/",
+    [BINOP_MOD       ] = "%",
+    [BINOP_LESS      ] = "<",
+    [BINOP_LESS_EQ   ] = "<=",
+    [BINOP_GREATER   ] = ">",
+    [BINOP_GREATER_EQ] = ">=",
+    [BINOP_EQ        ] = "==",
+    [BINOP_NOT_EQ    ] = "!="
+};
+
+enum ExprEnum {
+    EXPR_NUMERIC,
+    EXPR_STRING,
+    EXPR_VAR,
+    EXPR_INDEX,
+    EXPR_LENGTH,
+    EXPR_BINARY,
+    EXPR_CALL,
+    EXPR_STDCALL
+};
+
+typedef struct Expr Expr;
+typedef struct Func Func;
+
+// Postfix form of an expression, operands refer back to their tree nodes
+typedef struct {
+    enum {
+        RPN_OPERATOR,
+        RPN_NUM,
+        RPN_STRING,
+        RPN_VAR,
+        RPN_INDEX,
+        RPN_LENGTH,
+        RPN_CALL,
+        RPN_STDCALL
+    } type;
+    union {
+        Expr *expr;
+        ssize_t numeric;
+    };
+} RpnObject;
+
+// Expression tree node, token holds literal, variable or function name
+struct Expr {
+    enum ExprEnum kind;
+    Token token;
+    RpnObject *rpn;                  // postfix form cached on first evaluation
+    size_t rpnc;
+    size_t slot;                     // frame slot of the variable, set by resolver
+    Var_signature *decl;             // declaration of the variable, set by resolver
+    bool in_range;                   // index proven in bounds, EXPR_INDEX only, set by optimizer
+    union {
+        ssize_t num;                 // EXPR_NUMERIC
+        Expr *index;                 // EXPR_INDEX
+        struct {
+            enum BinopEnum op;
+            Expr *lhs;
+            Expr *rhs;
+        } binary;                    // EXPR_BINARY
+        struct {
+            Expr **args;
+            size_t argc;
+            Func *fn;                // callee bound by resolver, EXPR_CALL only
+            StdFunction std;         // handler bound by resolver, EXPR_STDCALL only
+            bool tail;               // 'return f(...)' reusing the frame, set by resolver
+        } call;                      // EXPR_CALL, EXPR_STDCALL
+    };
+};
+
+enum StmtEnum {
+    STMT_DECL,
+    STMT_ASSIGN,
+    STMT_EXPR,
+    STMT_IF,
+    STMT_WHILE,
+    STMT_FOR,
+    STMT_RETURN,
+    STMT_BREAK,
+    STMT_CONTINUE
+};
+
+typedef struct Stmt Stmt;
+typedef struct {
+    Stmt *stmts;
+    size_t stmtc;
+    size_t slot_start;               // slots of variables declared directly in block
+    size_t slot_end;
+} Block;
+
+// Statement tree node, token points to the statement keyword or variable name
+struct Stmt {
+    enum StmtEnum kind;
+    Token token;
+    union {
+        struct {
+            Var_signature sig;
+            Expr *size;              // array length, NULL for scalars
+            Expr *value;             // initializer, may be NULL
+            size_t slot;
+        } decl;
+        struct {
+            Expr *target;            // EXPR_VAR or EXPR_INDEX
+            enum BinopEnum op;       // BINOP_NONE for plain '='
+            Expr *value;
+        } assign;
+        Expr *expr;                  // STMT_EXPR, STMT_RETURN (NULL on bare return)
+        struct {
+            Expr *cond;
+            Block then_block;
+            Block else_block;
+        } if_stmt;
+        struct {
+            Expr *cond;
+            Block body;
+        } while_stmt;
+        struct {
+            Stmt *init;
+            Expr *cond;
+            Stmt *update;
+            Block body;
+        } for_stmt;
+    };
+};
+
+enum OpcodeEnum {
+    OP_LOADI,       // a = b
+    OP_LOADK,       // a = consts[b]
+    OP_LOADSTR,     // a = &strings[b]
+    OP_MOV,         // a = b
+    OP_ADD,         // a = b + c
+    OP_ADDI,        // a = b + imm c
+    OP_SUB,         // a = b - c
+    OP_MUL,         // a = b * c
+    OP_DIV,         // a = b / c
+    OP_MOD,         // a = b % c
+    OP_LESS,        // a = b < c
+    OP_LESS_EQ,     // a = b <= c
+    OP_GREATER,     // a = b > c
+    OP_GREATER_EQ,  // a = b >= c
+    OP_EQ,          // a = b == c
+    OP_NOT_EQ,      // a = b != c
+    OP_JMP,         // pc = b
+    OP_JZ,          // if(!a) pc = b
+    OP_JNZ,         // if(a) pc = b
+    OP_JLESS,       // if(a < b) pc = c
+    OP_JLESS_EQ,    // if(a <= b) pc = c
+    OP_JGREATER,    // if(a > b) pc = c
+    OP_JGREATER_EQ, // if(a >= b) pc = c
+    OP_JEQ,         // if(a == b) pc = c
+    OP_JNOT_EQ,     // if(a != b) pc = c
+    OP_NEWARR,      // a = new array of b items
+    OP_COPYARR,     // a = copy of a
+    OP_ASSIGNARR,   // items of a = items of b
+    OP_FREEARR,     // free(a)
+    OP_LEN,         // a = b.length
+    OP_LOADIDX_I8,  // a = b[c]
+    OP_LOADIDX_I32,
+    OP_LOADIDX_I64,
+    OP_STOREIDX_I8, // a[b] = c
+    OP_STOREIDX_I32,
+    OP_STOREIDX_I64,
+    OP_LOADIDXU_I8, // a = b[c], index is known to be in range
+    OP_LOADIDXU_I32,
+    OP_LOADIDXU_I64,
+    OP_STOREIDXU_I8, // a[b] = c, index is known to be in range
+    OP_STOREIDXU_I32,
+    OP_STOREIDXU_I64,
+    OP_CALL,        // a = functions.funcs[b](c, c+1, ...)
+    OP_TAILCALL,    // return functions.funcs[b](c, c+1, ...) in current frame
+    OP_STDCALL,     // a = stdcalls[b]
+    OP_RET,         // return a
+    OP_RETV,        // return 0
+    OP_PROFILE,     // --profile event a with row or function id b, on row c
+    OP_LOOP,        // loop body start, compiled by jit.c when b reaches 0
+    OP_COUNT
+};
+
+char *OP_TO_STR[] = {
+    [OP_LOADI        ] = "loadi",
+    [OP_LOADK        ] = "loadk",
+    [OP_LOADSTR      ] = "loadstr",
+    [OP_MOV          ] = "mov",
+    [OP_ADD          ] = "add",
+    [OP_ADDI         ] = "addi",
+    [OP_SUB          ] = "sub",
+    [OP_MUL          ] = "mul",
+    [OP_DIV          ] = "div",
+    [OP_MOD          ] = "mod",
+    [OP_LESS         ] = "less",
+    [OP_LESS_EQ      ] = "less_eq",
+    [OP_GREATER      ] = "greater",
+    [OP_GREATER_EQ   ] = "greater_eq",
+    [OP_EQ           ] = "eq",
+    [OP_NOT_EQ       ] = "not_eq",
+    [OP_JMP          ] = "jmp",
+    [OP_JZ           ] = "jz",
+    [OP_JNZ          ] = "jnz",
+    [OP_JLESS        ] = "jless",
+    [OP_JLESS_EQ     ] = "jless_eq",
+    [OP_JGREATER     ] = "jgreater",
+    [OP_JGREATER_EQ  ] = "jgreater_eq",
+    [OP_JEQ          ] = "jeq",
+    [OP_JNOT_EQ      ] = "jnot_eq",
+    [OP_NEWARR       ] = "newarr",
+    [OP_COPYARR      ] = "copyarr",
+    [OP_ASSIGNARR    ] = "assignarr",
+    [OP_FREEARR      ] = "freearr",
+    [OP_LEN          ] = "len",
+    [OP_LOADIDX_I8   ] = "loadidx_i8",
+    [OP_LOADIDX_I32  ] = "loadidx_i32",
+    [OP_LOADIDX_I64  ] = "loadidx_i64",
+    [OP_STOREIDX_I8  ] = "storeidx_i8",
+    [OP_STOREIDX_I32 ] = "storeidx_i32",
+    [OP_STOREIDX_I64 ] = "storeidx_i64",
+    [OP_LOADIDXU_I8  ] = "loadidxu_i8",
+    [OP_LOADIDXU_I32 ] = "loadidxu_i32",
+    [OP_LOADIDXU_I64 ] = "loadidxu_i64",
+    [OP_STOREIDXU_I8 ] = "storeidxu_i8",
+    [OP_STOREIDXU_I32] = "storeidxu_i32",
+    [OP_STOREIDXU_I64] = "storeidxu_i64",
+    [OP_CALL         ] = "call",
+    [OP_TAILCALL     ] = "tailcall",
+    [OP_STDCALL      ] = "stdcall",
+    [OP_RET          ] = "ret",
+    [OP_RETV         ] = "retv",
+    [OP_PROFILE      ] = "profile",
+    [OP_LOOP         ] = "loop",
+};
+
+// Value producing instructions range check their result against type
+typedef struct {
+    uint8_t op;
+    uint8_t type;
+    uint16_t a;
+    int32_t b;
+    int32_t c;
+} Instr;
+
+enum StdArgEnum {
+    STDARG_VALUE,   // scalar expression in reg
+    STDARG_LVALUE,  // scalar variable in reg, written back after call
+    STDARG_REF,     // array or string descriptor in reg
+    STDARG_ITEM,    // array reg item at index_reg
+    STDARG_STRING   // string literal strings[reg]
+};
+
+typedef struct {
+    enum StdArgEnum kind;
+    enum TypeEnum type;
+    SView name;
+    uint16_t reg;
+    uint16_t index_reg;
+    Location loc;        // array item, reported on index errors
+} StdArg;
+
+typedef struct {
+    StdFunction fn;
+    StdArg *args;
+    size_t argc;
+} StdCallSite;
+
+typedef struct {
+    Instr *code;
+    Token *tokens;       // source token of every instruction, for error locations
+    size_t codec;
+    ssize_t *consts;
+    size_t constc;
+    Variable *strings;
+    size_t stringc;
+    StdCallSite *stdcalls;
+    size_t stdcallc;
+    size_t regc;         // registers used by one frame
+} Bytecode;
+
+// Calls and loop iterations before a function is compiled to machine code
+#define JIT_HOT_CALLS 1000
+#define JIT_HOT_LOOPS 1000
+
+// Machine code runs on the VM registers of its frame and returns to the
+// interpreter at instruction pc, or with the return value of the function
+#define JIT_RETURNED SIZE_MAX
+typedef struct {
+    size_t pc;
+    ssize_t value;
+} JitExit;
+
+typedef JitExit (*JitEntry)(uint8_t *target, size_t base);
+
+typedef struct {
+    JitEntry entry;      // NULL until the function is hot
+    uint8_t *code;       // executable mapping of size bytes
+    size_t size;
+    size_t *offsets;     // code offset of every instruction
+    size_t countdown;    // calls until compiled, 1 once compiled
+    bool failed;
+} JitCode;
+
+// jump whose rel32 at 'at' is patched to instruction or bail out of 'target'
+typedef struct {
+    size_t at;
+    size_t target;
+    bool bail;
+} JitFixup;
+
+typedef struct {
+    uint8_t *data;
+    size_t size;
+    size_t cap;
+    JitFixup *fixups;
+    size_t fixupc;
+} JitBuffer;
+
+struct Func {
     SView name;
     enum TypeEnum ret_type;
     Var_signature *args;
     size_t argc;
     CodeBlock body;
-} Func;
+    Block block;
+    size_t slotc;        // frame slots for arguments and locals
+    Bytecode bytecode;
+    size_t profile_id;   // index+1 in profiler funcs, 0 before first profiled call
+    JitCode jit;
+};
+
+// Functions in definition order, with open addressing index by name.
+// funcs is not moved once loading is done, call sites point into it
+typedef struct {
+    Func *funcs;
+    size_t funcc;
+    size_t *index;       // function id+1, 0 is empty
+    size_t index_cap;    // power of two
+} FuncTable;
+
+typedef struct {
+    SView name;
+    enum TypeEnum type;
+    enum ModifyerEnum modifyer;
+    bool owned;          // array is freed when its scope ends
+    uint16_t reg;
+    size_t depth;
+    Var_signature *sig;
+} Local;
+
+typedef struct {
+    Func *fn;
+    Local *locals;
+    size_t localc;
+    size_t depth;
+    size_t next_slot;
+} Resolver;
+
+typedef struct {
+    size_t *breaks;
+    size_t breakc;
+    size_t *continues;
+    size_t continuec;
+    size_t depth;        // scope depth of the loop body
+} LoopLabels;
+
+typedef struct {
+    Func *fn;
+    Bytecode *bc;
+    Local *locals;
+    size_t localc;
+    size_t depth;
+    size_t next_reg;
+    Token target;        // variable currently assigned, named in overflow errors
+    LoopLabels *loop;
+} Compiler;
+
+typedef struct {
+    Func *fn;
+    Instr *pc;
+    size_t base;
+    uint16_t ret_reg;
+} VMFrame;
+
+typedef struct {
+    Value *stack;
+    size_t stack_cap;
+    VMFrame *frames;
+    size_t framec;
+    size_t frame_cap;
+} VM;
+
+// Tree-walker frames: slots of a call are carved from fixed chunks,
+// chunks never move, so frames stay valid while callee frames grow the stack
+#define FRAME_CHUNK_SLOTS 4096
+// C stack of tree-walker, user calls nest C calls there
+#define TREE_WALK_STACK ((size_t)(sizeof(void*) >= 8 ? 1 << 30 : 64 << 20))
+typedef struct {
+    Variable *slots;
+    size_t top;
+    size_t cap;
+} FrameChunk;
+
+typedef struct {
+    FrameChunk *chunks;
+    size_t chunkc;
+    size_t current;
+} FrameStack;
+
+typedef struct {
+    Variable *args;
+    size_t top;
+    size_t cap;
+} TailArgs;
+
+enum ProfileEvent {
+    PROFILE_STATEMENT,   // statement starts on row
+    PROFILE_LINE,        // row runs again without a new statement, loop conditions
+    PROFILE_CALL,
+    PROFILE_TAIL_CALL,
+    PROFILE_RETURN
+};
+
+// --profile counters, time in seconds. Lines are indexed by source row,
+// functions collect in order of their first call
+typedef struct {
+    size_t count;        // statements started on line
+    double self;         // time spent on line, callees excluded
+} LineProfile;
+
+typedef struct {
+    Func *fn;
+    size_t calls;
+    size_t active;       // frames of function on stack, recursion counts total once
+    double total;        // time from call to return, callees included
+    double self;
+} FuncProfile;
+
+typedef struct {
+    size_t func;         // index in profiler funcs
+    double start;
+    double callees;      // total time of returned callees
+    size_t row;          // caller line, continued on return
+} ProfileFrame;
+
+typedef struct {
+    char *source;
+    char *file_path;
+    LineProfile *lines;
+    size_t linec;
+    FuncProfile *funcs;
+    size_t funcc;
+    ProfileFrame *frames;
+    size_t framec;
+    size_t frame_cap;
+    size_t row;          // line running now
+    double mark;         // when row started running
+    double elapsed;      // time spent in main
+    bool reported;
+} Profiler;
+
+// --stats counters, bytes are as requested by the interpreter
+typedef struct {
+    size_t count;
+    size_t bytes;
+} AllocStats;
+
+// Placed before every counted block, keeps the block aligned for any type
+typedef union {
+    size_t size;         // bytes requested
+    max_align_t align;
+} AllocHeader;
+
+typedef struct {
+    AllocStats mallocs;
+    AllocStats callocs;
+    AllocStats reallocs;     // bytes grown
+    AllocStats frees;
+    AllocStats live;         // allocated and not freed yet
+    size_t name_lookups;     // resolver, once per variable use at load time
+    size_t locals_scanned;
+    size_t instructions;     // bytecode compiled, profile events excluded
+    size_t statements;
+    size_t expr_evaluations; // tree-walker only
+    size_t user_calls;       // tail calls included
+    size_t tail_calls;
+    size_t std_calls;
+} Stats;
+
+// --sample-profile keeps a shadow stack of user calls. The timer signal
+// adds the stack it interrupts to a call tree, nodes come from a pool
+// grown outside of the signal, so the handler never allocates.
+typedef struct {
+    Func *fn;
+    size_t row;              // line of the call in the calling function
+} CallFrame;
+
+typedef struct {
+    Func *fn;
+    size_t row;
+    size_t parent;           // node indexes, 0 is the root
+    size_t child;            // first child, 0 is none
+    size_t next;             // next sibling, 0 is none
+    size_t samples;
+} CallNode;
 
 typedef struct {
-    size_t return_token_id;
-    size_t return_function_id;
+    volatile CallFrame *frames;
+    volatile size_t framec;
+    size_t frame_cap;
+    CallNode *nodes;
+    volatile size_t nodec;
+    size_t node_cap;
+    volatile size_t push_limit; // framec below it pushes without growing, machine code tests it
+    size_t dropped;          // samples taken when the pool was full
 } CallStack;
 
 #endif 
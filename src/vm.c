@@ -0,0 +1,366 @@
+#include "types.h"
+#include "functions.h"
+
+// Register VM: executes bytecode produced by compiler.c.
+// Frames live on one growable register stack, calls do not recurse in C
+// unless they go through machine code of jit.c.
+
+VM vm = {0};
+
+void vm_reserve(size_t regc){
+    if(regc <= vm.stack_cap){
+        return;
+    }
+    size_t cap = vm.stack_cap ? vm.stack_cap : 256;
+    while(cap < regc){
+        cap *= 2;
+    }
+    vm.stack = realloc(vm.stack, sizeof(Value)*cap);
+    vm.stack_cap = cap;
+}
+
+void vm_push_frame(VMFrame frame){
+    if(vm.framec >= vm.frame_cap){
+        vm.frame_cap = vm.frame_cap ? vm.frame_cap*2 : 64;
+        vm.frames = realloc(vm.frames, sizeof(VMFrame)*vm.frame_cap);
+    }
+    vm.frames[vm.framec++] = frame;
+}
+
+// Profile instructions are only compiled in with --profile, --stats and
+// --sample-profile, machine code calls this for them too
+void vm_profile(enum ProfileEvent event, size_t arg, size_t row){
+    switch(event){
+        case PROFILE_STATEMENT: profile_statement(arg);                        break;
+        case PROFILE_LINE:      profile_switch(arg);                           break;
+        case PROFILE_CALL:      profile_enter(&functions.funcs[arg], row);     break;
+        case PROFILE_TAIL_CALL: profile_tail_call(&functions.funcs[arg], row); break;
+        case PROFILE_RETURN:    profile_leave();                               break;
+    }
+}
+
+// Views VM registers as variables, so std functions work with both interpreters
+void vm_stdcall(StdCallSite *site, Value *regs, Bytecode *bc, Value *dst){
+    Variable args[STD_MAX_ARGS];
+    for(size_t i = 0; i<site->argc; i++){
+        StdArg arg = site->args[i];
+        switch(arg.kind){
+            case STDARG_VALUE:
+                args[i] = (Variable){.type = TYPE_I64, .modifyer = MOD_NO_MOD, .num = regs[arg.reg].num};
+                break;
+            case STDARG_LVALUE:
+                args[i] = (Variable){.name = arg.name, .type = arg.type, .modifyer = MOD_NO_MOD, .num = regs[arg.reg].num};
+                break;
+            case STDARG_REF:
+                args[i] = *regs[arg.reg].ref;
+                args[i].name = arg.name;
+                break;
+            case STDARG_ITEM:
+                check_index(*regs[arg.reg].ref, regs[arg.index_reg].num, arg.loc);
+                args[i] = get_var_from_arr(*regs[arg.reg].ref, regs[arg.index_reg].num);
+                break;
+            case STDARG_STRING:
+                args[i] = bc->strings[arg.reg];
+                break;
+        }
+    }
+    stats.std_calls++;
+    dst->num = site->fn(args, site->argc).num;
+    for(size_t i = 0; i<site->argc; i++){
+        if(site->args[i].kind == STDARG_LVALUE){
+            regs[site->args[i].reg].num = args[i].num;
+        }
+    }
+}
+
+#define VM_TOKEN (fn->bytecode.tokens[pc - fn->bytecode.code - 1])
+#define VM_CHECK(value) \
+    if((value) < TYPE_MIN[instr.type] || (value) > TYPE_MAX[instr.type]){ \
+        range_error(instr.type, VM_TOKEN.sv, (value)); \
+    }
+#define VM_DIVISOR(value) \
+    if((value) == 0){ \
+        Token token = VM_TOKEN; \
+        RUNTIMEERROR(" Error: division by zero"); \
+    }
+#define VM_INDEX(arr, index) \
+    if((size_t)(index) >= (arr)->size){ \
+        check_index(*(arr), (index), VM_TOKEN.loc); \
+    }
+#define VM_LOADIDX(ctype) { \
+        Variable *arr = regs[instr.b].ref; \
+        ssize_t index = regs[instr.c].num; \
+        VM_INDEX(arr, index); \
+        regs[instr.a].num = ((ctype*)arr->ptr)[index]; \
+    }
+#define VM_STOREIDX(ctype) { \
+        Variable *arr = regs[instr.a].ref; \
+        ssize_t index = regs[instr.b].num; \
+        ssize_t value = regs[instr.c].num; \
+        VM_INDEX(arr, index); \
+        VM_CHECK(value); \
+        ((ctype*)arr->ptr)[index] = value; \
+    }
+#define VM_LOADIDXU(ctype) \
+    regs[instr.a].num = ((ctype*)regs[instr.b].ref->ptr)[regs[instr.c].num];
+#define VM_STOREIDXU(ctype) { \
+        ssize_t value = regs[instr.c].num; \
+        VM_CHECK(value); \
+        ((ctype*)regs[instr.a].ref->ptr)[regs[instr.b].num] = value; \
+    }
+#define VM_JUMP_IF(cond) \
+    if(cond){ \
+        pc = fn->bytecode.code + instr.c; \
+    }
+
+// Threaded dispatch jumps from handler to handler through OP_LABELS,
+// the portable build loops over switch
+#ifdef THREADED_DISPATCH
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpedantic"
+#define VM_CASE(op) op_##op
+#define VM_DISPATCH() instr = *pc++; goto *OP_LABELS[instr.op]
+#define VM_NEXT() VM_DISPATCH()
+#else
+#define VM_CASE(op) case op
+#define VM_DISPATCH()
+#define VM_NEXT() continue
+#endif
+
+// Runs fn from pc until it returns, frames below floor belong to callers
+ssize_t vm_execute(Func *fn, Instr *pc, size_t base){
+    size_t floor = vm.framec;
+    vm_reserve(base + fn->bytecode.regc);
+    Value *regs = vm.stack + base;
+    Instr instr;
+#ifdef THREADED_DISPATCH
+    static void *const OP_LABELS[OP_COUNT] = {
+        [OP_LOADI       ] = &&VM_CASE(OP_LOADI),
+        [OP_LOADK       ] = &&VM_CASE(OP_LOADK),
+        [OP_LOADSTR     ] = &&VM_CASE(OP_LOADSTR),
+        [OP_MOV         ] = &&VM_CASE(OP_MOV),
+        [OP_ADD         ] = &&VM_CASE(OP_ADD),
+        [OP_ADDI        ] = &&VM_CASE(OP_ADDI),
+        [OP_SUB         ] = &&VM_CASE(OP_SUB),
+        [OP_MUL         ] = &&VM_CASE(OP_MUL),
+        [OP_DIV         ] = &&VM_CASE(OP_DIV),
+        [OP_MOD         ] = &&VM_CASE(OP_MOD),
+        [OP_LESS        ] = &&VM_CASE(OP_LESS),
+        [OP_LESS_EQ     ] = &&VM_CASE(OP_LESS_EQ),
+        [OP_GREATER     ] = &&VM_CASE(OP_GREATER),
+        [OP_GREATER_EQ  ] = &&VM_CASE(OP_GREATER_EQ),
+        [OP_EQ          ] = &&VM_CASE(OP_EQ),
+        [OP_NOT_EQ      ] = &&VM_CASE(OP_NOT_EQ),
+        [OP_JMP         ] = &&VM_CASE(OP_JMP),
+        [OP_JZ          ] = &&VM_CASE(OP_JZ),
+        [OP_JNZ         ] = &&VM_CASE(OP_JNZ),
+        [OP_JLESS       ] = &&VM_CASE(OP_JLESS),
+        [OP_JLESS_EQ    ] = &&VM_CASE(OP_JLESS_EQ),
+        [OP_JGREATER    ] = &&VM_CASE(OP_JGREATER),
+        [OP_JGREATER_EQ ] = &&VM_CASE(OP_JGREATER_EQ),
+        [OP_JEQ         ] = &&VM_CASE(OP_JEQ),
+        [OP_JNOT_EQ     ] = &&VM_CASE(OP_JNOT_EQ),
+        [OP_NEWARR      ] = &&VM_CASE(OP_NEWARR),
+        [OP_COPYARR     ] = &&VM_CASE(OP_COPYARR),
+        [OP_ASSIGNARR   ] = &&VM_CASE(OP_ASSIGNARR),
+        [OP_FREEARR     ] = &&VM_CASE(OP_FREEARR),
+        [OP_LEN         ] = &&VM_CASE(OP_LEN),
+        [OP_LOADIDX_I8  ] = &&VM_CASE(OP_LOADIDX_I8),
+        [OP_LOADIDX_I32 ] = &&VM_CASE(OP_LOADIDX_I32),
+        [OP_LOADIDX_I64 ] = &&VM_CASE(OP_LOADIDX_I64),
+        [OP_STOREIDX_I8 ] = &&VM_CASE(OP_STOREIDX_I8),
+        [OP_STOREIDX_I32] = &&VM_CASE(OP_STOREIDX_I32),
+        [OP_STOREIDX_I64] = &&VM_CASE(OP_STOREIDX_I64),
+        [OP_LOADIDXU_I8  ] = &&VM_CASE(OP_LOADIDXU_I8),
+        [OP_LOADIDXU_I32 ] = &&VM_CASE(OP_LOADIDXU_I32),
+        [OP_LOADIDXU_I64 ] = &&VM_CASE(OP_LOADIDXU_I64),
+        [OP_STOREIDXU_I8 ] = &&VM_CASE(OP_STOREIDXU_I8),
+        [OP_STOREIDXU_I32] = &&VM_CASE(OP_STOREIDXU_I32),
+        [OP_STOREIDXU_I64] = &&VM_CASE(OP_STOREIDXU_I64),
+        [OP_CALL        ] = &&VM_CASE(OP_CALL),
+        [OP_TAILCALL    ] = &&VM_CASE(OP_TAILCALL),
+        [OP_STDCALL     ] = &&VM_CASE(OP_STDCALL),
+        [OP_RET         ] = &&VM_CASE(OP_RET),
+        [OP_RETV        ] = &&VM_CASE(OP_RETV),
+        [OP_PROFILE     ] = &&VM_CASE(OP_PROFILE),
+        [OP_LOOP        ] = &&VM_CASE(OP_LOOP),
+    };
+#endif
+    VM_DISPATCH();
+#ifndef THREADED_DISPATCH
+    for(;;){
+        instr = *pc++;
+        switch(instr.op){
+#endif
+            VM_CASE(OP_LOADI):
+                VM_CHECK(instr.b);
+                regs[instr.a].num = instr.b;
+                VM_NEXT();
+            VM_CASE(OP_LOADK):
+                VM_CHECK(fn->bytecode.consts[instr.b]);
+                regs[instr.a].num = fn->bytecode.consts[instr.b];
+                VM_NEXT();
+            VM_CASE(OP_LOADSTR):
+                regs[instr.a].ref = &fn->bytecode.strings[instr.b];
+                VM_NEXT();
+            VM_CASE(OP_MOV):
+                VM_CHECK(regs[instr.b].num);
+                regs[instr.a] = regs[instr.b];
+                VM_NEXT();
+            VM_CASE(OP_ADD):{
+                ssize_t value = regs[instr.b].num + regs[instr.c].num;
+                VM_CHECK(value);
+                regs[instr.a].num = value;
+            }VM_NEXT();
+            VM_CASE(OP_ADDI):{
+                ssize_t value = regs[instr.b].num + instr.c;
+                VM_CHECK(value);
+                regs[instr.a].num = value;
+            }VM_NEXT();
+            VM_CASE(OP_SUB):{
+                ssize_t value = regs[instr.b].num - regs[instr.c].num;
+                VM_CHECK(value);
+                regs[instr.a].num = value;
+            }VM_NEXT();
+            VM_CASE(OP_MUL):{
+                ssize_t value = regs[instr.b].num * regs[instr.c].num;
+                VM_CHECK(value);
+                regs[instr.a].num = value;
+            }VM_NEXT();
+            VM_CASE(OP_DIV):{
+                VM_DIVISOR(regs[instr.c].num);
+                ssize_t value = regs[instr.b].num / regs[instr.c].num;
+                VM_CHECK(value);
+                regs[instr.a].num = value;
+            }VM_NEXT();
+            VM_CASE(OP_MOD):{
+                VM_DIVISOR(regs[instr.c].num);
+                ssize_t value = regs[instr.b].num % regs[instr.c].num;
+                VM_CHECK(value);
+                regs[instr.a].num = value;
+            }VM_NEXT();
+            VM_CASE(OP_LESS):       regs[instr.a].num = regs[instr.b].num <  regs[instr.c].num; VM_NEXT();
+            VM_CASE(OP_LESS_EQ):    regs[instr.a].num = regs[instr.b].num <= regs[instr.c].num; VM_NEXT();
+            VM_CASE(OP_GREATER):    regs[instr.a].num = regs[instr.b].num >  regs[instr.c].num; VM_NEXT();
+            VM_CASE(OP_GREATER_EQ): regs[instr.a].num = regs[instr.b].num >= regs[instr.c].num; VM_NEXT();
+            VM_CASE(OP_EQ):         regs[instr.a].num = regs[instr.b].num == regs[instr.c].num; VM_NEXT();
+            VM_CASE(OP_NOT_EQ):     regs[instr.a].num = regs[instr.b].num != regs[instr.c].num; VM_NEXT();
+            VM_CASE(OP_JMP):
+                pc = fn->bytecode.code + instr.b;
+                VM_NEXT();
+            VM_CASE(OP_JZ):
+                if(!regs[instr.a].num){
+                    pc = fn->bytecode.code + instr.b;
+                }
+                VM_NEXT();
+            VM_CASE(OP_JNZ):
+                if(regs[instr.a].num){
+                    pc = fn->bytecode.code + instr.b;
+                }
+                VM_NEXT();
+            VM_CASE(OP_JLESS):       VM_JUMP_IF(regs[instr.a].num <  regs[instr.b].num); VM_NEXT();
+            VM_CASE(OP_JLESS_EQ):    VM_JUMP_IF(regs[instr.a].num <= regs[instr.b].num); VM_NEXT();
+            VM_CASE(OP_JGREATER):    VM_JUMP_IF(regs[instr.a].num >  regs[instr.b].num); VM_NEXT();
+            VM_CASE(OP_JGREATER_EQ): VM_JUMP_IF(regs[instr.a].num >= regs[instr.b].num); VM_NEXT();
+            VM_CASE(OP_JEQ):         VM_JUMP_IF(regs[instr.a].num == regs[instr.b].num); VM_NEXT();
+            VM_CASE(OP_JNOT_EQ):     VM_JUMP_IF(regs[instr.a].num != regs[instr.b].num); VM_NEXT();
+            VM_CASE(OP_NEWARR):{
+                ssize_t size = regs[instr.b].num;
+                if(size < 0){
+                    Token token = VM_TOKEN;
+                    RUNTIMEERROR(" Error: negative array size");
+                }
+                regs[instr.a].ref = new_array(instr.type, size, VM_TOKEN.sv);
+            }VM_NEXT();
+            VM_CASE(OP_COPYARR):{
+                Variable *src = regs[instr.a].ref;
+                Variable *arr = new_array(src->type, src->size, src->name);
+                memcpy(arr->ptr, src->ptr, get_type_size_in_bytes(src->type)*src->size);
+                regs[instr.a].ref = arr;
+            }VM_NEXT();
+            VM_CASE(OP_ASSIGNARR):
+                assign_array(*regs[instr.a].ref, *regs[instr.b].ref, VM_TOKEN.loc);
+                VM_NEXT();
+            VM_CASE(OP_FREEARR):
+                free(regs[instr.a].ref);
+                VM_NEXT();
+            VM_CASE(OP_LEN):
+                VM_CHECK((ssize_t)regs[instr.b].ref->size);
+                regs[instr.a].num = regs[instr.b].ref->size;
+                VM_NEXT();
+            VM_CASE(OP_LOADIDX_I8):   VM_LOADIDX(int8_t);   VM_NEXT();
+            VM_CASE(OP_LOADIDX_I32):  VM_LOADIDX(int32_t);  VM_NEXT();
+            VM_CASE(OP_LOADIDX_I64):  VM_LOADIDX(ssize_t);  VM_NEXT();
+            VM_CASE(OP_STOREIDX_I8):  VM_STOREIDX(int8_t);  VM_NEXT();
+            VM_CASE(OP_STOREIDX_I32): VM_STOREIDX(int32_t); VM_NEXT();
+            VM_CASE(OP_STOREIDX_I64): VM_STOREIDX(ssize_t); VM_NEXT();
+            VM_CASE(OP_LOADIDXU_I8):   VM_LOADIDXU(int8_t);   VM_NEXT();
+            VM_CASE(OP_LOADIDXU_I32):  VM_LOADIDXU(int32_t);  VM_NEXT();
+            VM_CASE(OP_LOADIDXU_I64):  VM_LOADIDXU(ssize_t);  VM_NEXT();
+            VM_CASE(OP_STOREIDXU_I8):  VM_STOREIDXU(int8_t);  VM_NEXT();
+            VM_CASE(OP_STOREIDXU_I32): VM_STOREIDXU(int32_t); VM_NEXT();
+            VM_CASE(OP_STOREIDXU_I64): VM_STOREIDXU(ssize_t); VM_NEXT();
+            VM_CASE(OP_CALL):{
+                Func *callee = &functions.funcs[instr.b];
+                if(--callee->jit.countdown == 0 && jit_ready(callee)){
+                    ssize_t value = jit_call(callee, base + instr.c);
+                    regs = vm.stack + base;
+                    regs[instr.a].num = value;
+                    VM_NEXT();
+                }
+                vm_push_frame((VMFrame){.fn = fn, .pc = pc, .base = base, .ret_reg = instr.a});
+                base += instr.c;
+                vm_reserve(base + callee->bytecode.regc);
+                regs = vm.stack + base;
+                fn = callee;
+                pc = fn->bytecode.code;
+            }VM_NEXT();
+            VM_CASE(OP_TAILCALL):{ // arguments move down to the frame start, frame is reused
+                Func *callee = &functions.funcs[instr.b];
+                for(size_t i = 0; i<callee->argc; i++){
+                    regs[i] = regs[instr.c+i];
+                }
+                vm_reserve(base + callee->bytecode.regc);
+                regs = vm.stack + base;
+                fn = callee;
+                pc = fn->bytecode.code;
+            }VM_NEXT();
+            VM_CASE(OP_STDCALL):
+                global_location = VM_TOKEN.loc;
+                vm_stdcall(&fn->bytecode.stdcalls[instr.b], regs, &fn->bytecode, &regs[instr.a]);
+                VM_CHECK(regs[instr.a].num);
+                VM_NEXT();
+            VM_CASE(OP_PROFILE):
+                vm_profile(instr.a, instr.b, instr.c);
+                VM_NEXT();
+            VM_CASE(OP_LOOP):
+                if(--pc[-1].b == 0){
+                    pc = jit_loop(fn, pc, base);
+                    regs = vm.stack + base;
+                }
+                VM_NEXT();
+            VM_CASE(OP_RET):
+            VM_CASE(OP_RETV):{
+                Value ret = {.num = 0};
+                if(instr.op == OP_RET){
+                    ret = regs[instr.a];
+                }
+                if(vm.framec == floor){
+                    return ret.num;
+                }
+                VMFrame frame = vm.frames[--vm.framec];
+                fn   = frame.fn;
+                pc   = frame.pc;
+                base = frame.base;
+                regs = vm.stack + base;
+                regs[frame.ret_reg] = ret;
+            }VM_NEXT();
+#ifndef THREADED_DISPATCH
+        }
+    }
+#endif
+}
+
+#ifdef THREADED_DISPATCH
+#pragma GCC diagnostic pop
+#endif
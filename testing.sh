@@ -1,6 +1,31 @@
-arr=`ls examples`
-set -e
-for i in $arr; do
+# Runs every example with the default engines, with the VM only (--no-jit),
+# with the tree-walker (--tree-walk) and with array functions limited to
+# scalar and SSE2 code (--simd), and fails when outputs or exit codes
+# differ. Examples calling std.random are run but not compared.
+input="3\n10\n20\n30\n"
+out=`mktemp -d`
+trap 'rm -rf "$out"' EXIT
+failed=0
+for i in `ls examples`; do
     echo "# running "$i"...";
-    ./ciberia ./examples/$i
+    for mode in default no-jit tree-walk simd=scalar simd=sse2; do
+        flag=""
+        if [ $mode != default ]; then
+            flag="--$mode"
+        fi
+        printf "$input" | ./ciberia $flag ./examples/$i > "$out/$mode" 2>&1
+        echo "exit $?" >> "$out/$mode"
+    done
+    cat "$out/default"
+    if grep -q "std.random" ./examples/$i; then
+        continue
+    fi
+    for mode in no-jit tree-walk simd=scalar simd=sse2; do
+        if ! diff "$out/default" "$out/$mode" > "$out/diff"; then
+            echo "# FAILED "$i": --$mode output differs"
+            cat "$out/diff"
+            failed=1
+        fi
+    done
 done
+exit $failed